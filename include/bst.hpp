@@ -7,14 +7,29 @@
 #include <sstream>      // ""
 #include <functional>   // for std::less
 #include <cmath>        // used in balancing
+#include <new>          // for placement new
+#include <type_traits>  // for std::is_trivially_destructible
+#include <iterator>     // for std::distance, std::make_move_iterator
+#include <vector>       // buffer used when bulk loading unsorted ranges
+#include <algorithm>    // for std::stable_sort
+#include <tuple>        // for std::forward_as_tuple (in-place node construction)
+#include <atomic>       // share counts of copy-on-write trees
+#include <future>       // for std::async (set operations)
+#include <thread>       // for std::thread::hardware_concurrency
+#include <stdexcept>    // for std::invalid_argument
+#include <memory>       // for std::unique_ptr (partial results of parallel_reduce)
+
+#include "node_alloc.hpp"
+#include "key_compare.hpp"
+#include "frozen_bst.hpp"
 
 
 // forward declarations for friend operator<<
-template< class K, class V, class cmp>
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
 class Bst;
 
-template< class K, class V, class cmp>
-std::ostream& operator<<(std::ostream& , const Bst<K,V,cmp>&);
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+std::ostream& operator<<(std::ostream& , const Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>&);
 
 /// @brief Recreates the string to be centered in a string of given size.
 ///        Eventual excess space is put on the left.
@@ -34,16 +49,46 @@ std::string& centered(std::string &s,std::size_t size,const char &fill_c=' '){
     return s;
 }
 
+//------------------
+// Balancing policies
+//------------------
+
+/// @brief Default balancing policy: the tree is never rebalanced automatically,
+///        hence its shape depends on the insertion order (see Bst::balance()).
+struct unbalanced{};
+
+/// @brief AVL balancing policy: insertions and removals rotate nodes so that
+///        sibling subtrees never differ in height by more than one, hence
+///        the tree height is always O(log(size)).
+struct avl{};
+
+/// @brief How the key/value pairs given to range ctors/assign() are ordered.
+enum class range_order{
+    sorted_unique,  ///< strictly increasing keys
+    sorted,         ///< non-decreasing keys (only the first of equal keys is kept)
+    unsorted        ///< any order: pairs are copied and sorted first
+};
+
 /// @brief Binary search tree data structure.
 /// 
 /// This template class implements a Binary Search Tree
 /// for storing key-value pairs ordered accordingly to a given
 /// comparator (defaults to <).
 /// 
-/// @tparam K   Type of the keys used to order the nodes in the BST
-/// @tparam V   Type of the values stored in the nodes
-/// @tparam Cmp Comparator class (default: std::less<K>)
-template< class K, class V, class cmp = std::less<K> >
+/// @tparam K       Type of the keys used to order the nodes in the BST
+/// @tparam V       Type of the values stored in the nodes
+/// @tparam Cmp     Comparator class (default: std::less<K>)
+/// @tparam Alloc   Node allocation policy (default: heap_allocator, see node_alloc.hpp)
+/// @tparam Balance Balancing policy (default: unbalanced, see also avl)
+/// @tparam order_stats If true, nodes keep track of their subtree size so that
+///                     nth(), rank() and count_range() run in O(height) (default: false)
+/// @tparam copy_on_write If true, copies share the nodes of the original until either
+///                       of them changes (default: false, copies are deep). Then the first
+///                       change after a copy moves the tree onto nodes of its own, invalidating
+///                       every iterator (const ones too) and reference into it; and a tree that
+///                       handed out a non-const iterator or reference (operator[], non-const
+///                       begin(), find(), insert()...) is copied deeply until it is cleared
+template< class K, class V, class cmp = std::less<K>, template<class> class Alloc = heap_allocator, class Balance = unbalanced, bool order_stats = false, bool copy_on_write = false >
 class Bst{
     
   public:
@@ -51,18 +96,32 @@ class Bst{
 
   private:
 
+    // the concurrent wrapper walks the nodes itself (see concurrent_bst.hpp)
+    template< class, class, class, template<class> class, class > friend class ConcurrentBst;
+
+    /// @brief Subtree size, only stored in nodes when order_stats is on.
+    struct node_count{
+        unsigned int count{1}; ///< number of nodes in the subtree rooted at this node
+    };
+
+    /// @brief Empty base of nodes when order_stats is off (takes no room).
+    struct no_node_count{};
+
     /// @brief Tree nodes.
     /// 
     /// These make up the actual memory store of the bst.
-    /// Node allocation is managed by the enclosing bst class, hence
-    /// CHILD DEALLOCATION MUST BE HANDLED MANUALLY by delete_subtree_rec()
-    struct Node{
+    /// Node allocation is managed by the enclosing bst class through its
+    /// allocation policy, hence nodes DO NOT OWN THEIR CHILDREN:
+    /// subtrees are copied and freed by copy_subtree() and destroy_subtree().
+    struct Node: std::conditional<order_stats,node_count,no_node_count>::type{
         kvpair kv;
 
         Node* parent{nullptr};
         Node* l_child{nullptr};
         Node* r_child{nullptr};
 
+        int height{0}; ///< height of the subtree rooted at this node
+
         /// @brief Construct a new Node object.
         /// 
         /// @param p_kv kvpair to copy into the node
@@ -73,18 +132,16 @@ class Bst{
         /// @param p_kv kvpair to move into the node
         Node(kvpair&& p_kv): kv{std::move(p_kv)}{};
 
-        /// @brief Deep-copy ctor.
-        ///
-        ///        Copies the input node and all of its children.
-        /// @param node 
-        Node(const Node& node);
-
-        /// @brief Recursively deletes all node's descents.
-        void delete_subtree_rec();
-
-        /// @brief Destroy the Node object and its descents.
-        ///        Calls delete_subtree_rec()
-        ~Node(){delete_subtree_rec();}
+        /// @brief Construct a new Node object building kv in place
+        ///        (the key is copied/moved only once, the value is built from vargs).
+        /// 
+        /// @param key      key to forward to K ctor
+        /// @param vargs    values forwarded to V ctor
+        template< class KT, class... VArgs >
+        Node(std::piecewise_construct_t, KT&& key, VArgs&&... vargs):
+            kv{std::piecewise_construct,
+               std::forward_as_tuple(std::forward<KT>(key)),
+               std::forward_as_tuple(std::forward<VArgs>(vargs)...)}{};
 
     };
 
@@ -130,6 +187,38 @@ class Bst{
         return target;
     }
 
+    /// @brief Private helper function to go through tree nodes in reverse cmp order.
+    ///        Mirrors select_next_node().
+    /// 
+    /// @param n        Element of which we'd like to get the previous in ordering
+    /// @return Node*   Previous node (may be nullptr)
+    static Node* select_prev_node(Node* n) noexcept{
+        if(n == nullptr){
+            return nullptr;
+        }
+
+        Node* target{nullptr};
+
+        // 1. rightmost of l_child subtree
+        if(n->l_child){
+            target = n->l_child;
+            while(target->r_child){
+                target = target->r_child;
+            }
+        }
+        //2. first ancestor whose r_child is ancestor
+        else{
+            target = n;
+            while( (target->parent!=nullptr) &&
+                (target != (target->parent->r_child))){
+                target = target->parent;
+            }
+            target = target->parent;
+        }
+
+        return target;
+    }
+
     /// @brief Base template iterator class.
     /// 
     /// Used to define both iterator and const_iterator avoiding
@@ -140,9 +229,18 @@ class Bst{
         
         Node* current; ///< pointer to current node
 
+        friend class Bst;
+        template<class> friend class _iterator;
+
       public:
         explicit _iterator(Node* n): current(n){};
 
+        /// @brief Conversion from iterator to const_iterator.
+        /// 
+        /// @param it iterator to convert
+        template<class KV2, class = typename std::enable_if<std::is_same<const KV2,KV>::value>::type>
+        _iterator(const _iterator<KV2>& it): current(it.current){};
+
         /// @brief Equality check
         /// 
         /// @param rhs 
@@ -185,27 +283,374 @@ class Bst{
         }
     };
 
+    Alloc<Node> alloc; ///< node memory store
+
     Node* root; ///< holds the root node of the tree
+    Node* last_node; ///< greatest node (cached, so that hints at end() cost O(1))
 
     unsigned int size;
-    int height;
 
-    /// @brief Recursive function to compute the height of a subtree given its root pointer.
+    /// @brief Allocates a new node through the allocation policy and constructs it in place.
+    /// 
+    /// @tparam Args    Node ctor argument types
+    /// @param args     Values forwarded to Node ctor
+    /// @return Node*   the new (parentless, childless) node
+    template< class... Args >
+    Node* create_node(Args&&... args);
+
+    /// @brief Destroys a single node and gives its memory back to the allocation policy.
+    ///        Children are NOT touched.
+    /// 
+    /// @param n node to destroy
+    void destroy_node(Node* n) noexcept{
+        n->~Node();
+        alloc.deallocate(n);
+    }
+
+    /// @brief Deep-copies a subtree, allocating the copies from this tree.
+    ///        Single pre-order pass that follows parent links (no recursion,
+    ///        O(1) extra memory), hence safe on degenerate trees of any depth.
+    ///        The allocator is told up front how many nodes are coming,
+    ///        so that an arena can serve them all from one block.
+    /// 
+    /// @param n        root of the subtree to copy (may be nullptr)
+    /// @param n_nodes  number of nodes in the subtree
+    /// @return Node*   root of the copy (parentless)
+    Node* copy_subtree(const Node* n, unsigned int n_nodes);
+
+    /// @brief Destroys a subtree by a post-order walk that follows parent links
+    ///        (no recursion, O(1) extra memory).
+    /// 
+    /// @param n root of the subtree to destroy
+    void destroy_subtree(Node* n) noexcept;
+
+    /// @brief Height of a subtree given its root pointer (-1 if empty).
     /// 
     /// @param n    subtree root
     /// @return int height of the subtree rooted at n
-    int compute_height_rec(Node* n) noexcept;
+    static int node_height(const Node* n) noexcept{ return n? n->height : -1;}
+
+    /// @brief Recomputes the height of a single node from those of its children.
+    /// 
+    /// @param n        node to update
+    /// @return true    if the height of n changed
+    static bool update_height(Node* n) noexcept{
+        int hl{node_height(n->l_child)}, hr{node_height(n->r_child)};
+        int h{1 + (hl>hr?hl:hr)};
+        bool changed{h!=n->height};
+        n->height = h;
+        return changed;
+    }
+
+    /// @brief Refreshes heights walking up from n, stopping as soon as one is unchanged
+    ///        (higher ones cannot change either). To be used when adding/removing nodes.
+    /// 
+    /// @param n lowest node whose subtree changed (may be nullptr)
+    void update_heights(Node* n) noexcept{
+        while(n && update_height(n)){ n = n->parent;}
+    }
+
+    //--------------
+    // Subtree sizes
+    //--------------
+
+    using count_tag = std::integral_constant<bool,order_stats>;
+
+    /// @brief Size of a subtree given its root pointer (0 if empty). order_stats only.
+    /// 
+    /// @param n                subtree root
+    /// @return unsigned int    number of nodes in the subtree rooted at n
+    static unsigned int node_count_of(const Node* n) noexcept{ return n? n->count : 0;}
+
+    /// @brief Recomputes the subtree size of a single node from those of its children
+    ///        (no-op unless order_stats is on).
+    /// 
+    /// @param n node to update
+    static void update_count(Node* n) noexcept{ update_count(n,count_tag{});}
+    static void update_count(Node*, std::false_type) noexcept{}
+    static void update_count(Node* n, std::true_type) noexcept{
+        n->count = 1 + node_count_of(n->l_child) + node_count_of(n->r_child);
+    }
+
+    /// @brief Adds delta to the subtree size of n and of all its ancestors
+    ///        (no-op unless order_stats is on). To be used when adding/removing nodes.
+    /// 
+    /// @param n        lowest node whose subtree changed (may be nullptr)
+    /// @param delta    +1 on insertion, -1 on removal
+    static void shift_counts(Node* n, int delta) noexcept{ shift_counts(n,delta,count_tag{});}
+    static void shift_counts(Node*, int, std::false_type) noexcept{}
+    static void shift_counts(Node* n, int delta, std::true_type) noexcept{
+        for(; n; n = n->parent){ n->count += delta;}
+    }
+
+    //--------------
+    // Copy-on-write
+    //--------------
 
-    /// @brief Recomputes the height of the tree. To be used when removing nodes.
+    using cow_tag = std::integral_constant<bool,copy_on_write>;
+
+    // nodes shared by many trees are freed by whichever tree lets them go last
+    static_assert(!copy_on_write || std::is_empty<Alloc<Node>>::value,
+                  "copy_on_write needs a stateless allocation policy (e.g. heap_allocator)");
+
+    /// @brief Number of trees sharing a set of nodes (copy_on_write only).
+    struct cow_share{
+        std::atomic<unsigned int> refs{1};
+    };
+
+    /// @brief Share count of the nodes (copy_on_write only). Allocated by the first change,
+    ///        hence never nullptr while the tree is not empty.
+    cow_share* share{nullptr};
+
+    /// @brief Whether non-const iterators or references may still point into the tree
+    ///        (copy_on_write only): copies of the tree are then deep, or writes through those
+    ///        handles would show in the copies as well. Set by hand_out(); as iterators survive
+    ///        insertions and erasures, only clear() (and assignments) reset it, and nodes moving
+    ///        to another tree (split, join, merges) carry it along.
+    bool unshareable{false};
+
+    /// @brief Whether a copy of bst may share its nodes.
+    static bool can_share(const Bst& bst) noexcept{ return copy_on_write && !bst.unshareable;}
+
+    /// @brief To be called before any change: if the nodes are shared with other trees,
+    ///        makes a private deep copy of them first (no-op unless copy_on_write is on).
+    ///        If finger points to a node, it is moved to the matching node of the copy.
+    ///
+    /// @param finger   (in/out, may be nullptr) node to track through the copy
+    void unshare(Node** finger = nullptr){ unshare(finger,cow_tag{});}
+    void unshare(Node**, std::false_type) noexcept{}
+    void unshare(Node** finger, std::true_type);
+
+    /// @brief To be called before handing out a non-const iterator or reference:
+    ///        unshare()s, then keeps the tree from sharing its nodes until it is cleared.
+    ///
+    /// @param finger   (in/out, may be nullptr) node to track through the copy
+    void hand_out(Node** finger = nullptr){
+        unshare(finger);
+        unshareable = copy_on_write;
+    }
+
+    /// @brief Lets the nodes go if other trees share them (they are theirs to free then).
+    ///
+    /// @return true    if the nodes were shared, and are no longer referenced by this tree
+    /// @return false   if the nodes are only this tree's (to be freed by the caller)
+    bool leave_share() noexcept{ return leave_share(cow_tag{});}
+    bool leave_share(std::false_type) noexcept{ return false;}
+    bool leave_share(std::true_type) noexcept;
+
+    /// @brief Counts one more tree sharing the nodes of bst (copy_on_write only).
+    ///        Empty trees share nothing, so that a tree without nodes never holds a
+    ///        share count used by others.
+    ///
+    /// @return cow_share* share count of bst (nullptr if not copy_on_write or bst is empty)
+    static cow_share* join_share(const Bst& bst) noexcept{
+        if(!copy_on_write || bst.root==nullptr){ return nullptr;}
+        bst.share->refs.fetch_add(1,std::memory_order_relaxed);
+        return bst.share;
+    }
+
+    //----------
+    // Rotations
+    //----------
+
+    /// @brief Rotates left the subtree rooted at n (n's right child takes its place).
+    ///        Parent links are kept consistent, root is not touched (see rotate_left()).
+    /// 
+    /// @param n        subtree root. Must have a right child.
+    /// @return Node*   the node that took n's place
+    static Node* rotate_left_links(Node* n) noexcept;
+
+    /// @brief Rotates right the subtree rooted at n (n's left child takes its place).
+    ///        Parent links are kept consistent, root is not touched (see rotate_right()).
+    /// 
+    /// @param n        subtree root. Must have a left child.
+    /// @return Node*   the node that took n's place
+    static Node* rotate_right_links(Node* n) noexcept;
+
+    /// @brief Rotates left the subtree rooted at n (n's right child takes its place).
+    ///        Parent links (and root) are kept consistent.
+    /// 
+    /// @param n subtree root. Must have a right child.
+    void rotate_left(Node* n) noexcept{
+        Node* r{rotate_left_links(n)};
+        if(r->parent==nullptr){ root = r;}
+    }
+
+    /// @brief Rotates right the subtree rooted at n (n's left child takes its place).
+    ///        Parent links (and root) are kept consistent.
+    /// 
+    /// @param n subtree root. Must have a left child.
+    void rotate_right(Node* n) noexcept{
+        Node* l{rotate_right_links(n)};
+        if(l->parent==nullptr){ root = l;}
+    }
+
+    /// @brief Walks from n up to root, updating heights and rotating
+    ///        unbalanced subtrees. Stops at the first subtree whose height is unchanged.
+    /// 
+    /// @param n lowest node whose subtree changed (may be nullptr)
+    void avl_rebalance(Node* n) noexcept;
+
+    /// @brief Restores balancing policy invariants after a node was linked.
+    /// 
+    /// @param n the new node
+    void fix_after_insert(Node* n, unbalanced) noexcept{ update_heights(n->parent);}
+    void fix_after_insert(Node* n, avl) noexcept{ avl_rebalance(n->parent);}
+
+    /// @brief Restores balancing policy invariants after a node was unlinked.
+    /// 
+    /// @param p parent of the removed node
+    void fix_after_erase(Node* p, unbalanced) noexcept{ update_heights(p);}
+    void fix_after_erase(Node* p, avl) noexcept{ avl_rebalance(p);}
+
+    /// @brief Greatest node of a subtree.
+    /// 
+    /// @param n        subtree root (may be nullptr)
+    /// @return Node*   rightmost node of the subtree (nullptr if empty)
+    static Node* rightmost(Node* n) noexcept{
+        if(n){
+            while(n->r_child){ n = n->r_child;}
+        }
+        return n;
+    }
+
+    /// @brief Smallest node of a subtree.
+    /// 
+    /// @param n        subtree root (may be nullptr)
+    /// @return Node*   leftmost node of the subtree (nullptr if empty)
+    static Node* leftmost(Node* n) noexcept{
+        if(n){
+            while(n->l_child){ n = n->l_child;}
+        }
+        return n;
+    }
+
+    //---------------
+    // Split and join
+    //---------------
+
+    // The helpers below work on detached subtrees (parentless roots) and never touch
+    // root, last_node nor size, so that disjoint subtrees can be worked on by different
+    // threads. Nodes move from tree to tree, hence the stateless allocation policy.
+
+    /// @brief Walks from n up to the top of its (detached) subtree, refreshing heights and
+    ///        subtree sizes and, for avl, rotating unbalanced nodes. Unlike avl_rebalance(),
+    ///        it goes all the way up, as sizes change all along the path.
+    /// 
+    /// @param n        lowest node whose subtree changed
+    /// @return Node*   top of the subtree
+    static Node* fix_up(Node* n, unbalanced) noexcept;
+    static Node* fix_up(Node* n, avl) noexcept;
+
+    /// @brief Links l and r below m.
+    /// 
+    /// @return Node* m, parentless
+    static Node* link_nodes(Node* l, Node* m, Node* r) noexcept;
+
+    /// @brief Joins two detached subtrees through a middle node (keys of l < key of m < keys of r).
+    ///        For avl, m goes down the spine of the taller subtree, to the first node at most one
+    ///        level taller than the other subtree, and rotations fix the path back up:
+    ///        O(|height(l)-height(r)|), the result is balanced. Without balancing, O(1).
+    /// 
+    /// @param l        subtree of the smaller keys (may be nullptr)
+    /// @param m        middle node (its links are overwritten)
+    /// @param r        subtree of the greater keys (may be nullptr)
+    /// @return Node*   root of the joined subtree
+    static Node* join_nodes(Node* l, Node* m, Node* r) noexcept{ return join_nodes(l,m,r,Balance{});}
+    static Node* join_nodes(Node* l, Node* m, Node* r, unbalanced) noexcept{ return link_nodes(l,m,r);}
+    static Node* join_nodes(Node* l, Node* m, Node* r, avl) noexcept;
+
+    /// @brief Joins two detached subtrees (keys of l < keys of r): the greatest node of l
+    ///        is taken out and becomes the middle node.
+    /// 
+    /// @return Node* root of the joined subtree
+    static Node* join_nodes(Node* l, Node* r) noexcept;
+
+    /// @brief Takes a detached subtree apart along the search path of key, joining the pieces
+    ///        hanging on either side of it: O(height) joins, whose costs add up to O(log N) for avl.
+    /// 
+    /// @param n        root of the subtree (may be nullptr)
+    /// @param key      key to split around
+    /// @param l        (out) subtree of the keys less than key
+    /// @param r        (out) subtree of the keys greater than key
+    /// @return Node*   the node holding key, detached (nullptr if none)
+    template< class KT >
+    static Node* split_nodes(Node* n, const KT& key, Node*& l, Node*& r) noexcept;
+
+    /// @brief Size of l, l and r being the two parts of a subtree of n_nodes nodes: read in O(1)
+    ///        with order_stats, otherwise counted walking l and r side by side, O(min(|l|,|r|)).
+    /// 
+    /// @param n_nodes          |l|+|r|
+    /// @return unsigned int    |l|
+    static unsigned int split_size(Node* l, Node*, unsigned int, std::true_type) noexcept{ return node_count_of(l);}
+    static unsigned int split_size(Node* l, Node* r, unsigned int n_nodes, std::false_type) noexcept;
+
+    /// @brief Puts subtree sub in the place of node x, in a detached subtree.
+    /// 
+    /// @param x        node to replace (left as it is)
+    /// @param sub      detached subtree (may be nullptr)
+    /// @return Node*   top of the subtree, after fixing the path up from x's place
+    static Node* replace_node(Node* x, Node* sub) noexcept;
+
+    /// @brief Number of nodes of a subtree: read in O(1) with order_stats, counted in O(N) otherwise.
+    static unsigned int count_nodes(Node* n, std::true_type) noexcept{ return node_count_of(n);}
+    static unsigned int count_nodes(Node* n, std::false_type) noexcept{
+        unsigned int c{0};
+        for(n = leftmost(n); n; n = select_next_node(n)){ ++c;}
+        return c;
+    }
+
+    /// @brief Below this many nodes of the other tree, set operations do not fork anymore.
+    static constexpr unsigned int parallel_grain{1024};
+
+    /// @brief Runs left and right, on two threads if threads>1 (on this one only, if no thread can be started).
+    ///        Exceptions are passed on once both are done.
+    template< class FL, class FR >
+    static void fork_join(unsigned int threads, FL left, FR right);
+
+    /// @brief Union of a detached subtree and the nodes[lo,hi) of another tree (in key order),
+    ///        which are all linked in: nodes of t whose key is also in there are destroyed.
+    ///        Splits t around the middle node, recurses on both sides (in parallel) and joins.
     /// 
-    void recompute_height() noexcept;
+    /// @param t        root of the subtree (may be nullptr)
+    /// @param nodes    nodes of the other tree, in key order
+    /// @param lo, hi   range of nodes to merge in
+    /// @param threads  threads available
+    /// @param dropped  (in/out) incremented by the number of nodes destroyed
+    /// @return Node*   root of the union
+    Node* union_nodes(Node* t, Node* const* nodes, unsigned int lo, unsigned int hi,
+                      unsigned int threads, unsigned int& dropped) noexcept;
+
+    /// @brief Intersection of a detached subtree and the keys of nodes[lo,hi) (in key order):
+    ///        nodes of t whose key is not in there are destroyed. See union_nodes().
+    Node* intersect_nodes(Node* t, const Node* const* nodes, unsigned int lo, unsigned int hi,
+                          unsigned int threads, unsigned int& dropped) noexcept;
+
+    /// @brief Difference of a detached subtree and the keys of nodes[lo,hi) (in key order):
+    ///        nodes of t whose key is in there are destroyed. See union_nodes().
+    Node* difference_nodes(Node* t, const Node* const* nodes, unsigned int lo, unsigned int hi,
+                           unsigned int threads, unsigned int& dropped) noexcept;
 
   public:
 
     // ctors, dtors -----------------------------------------------------------
-    Bst(): root{nullptr}, size{0}, height{-1}{};
+    Bst(): root{nullptr}, last_node{nullptr}, size{0}{};
 
-    ~Bst(){ if(root){delete root;}}
+    /// @brief Bulk-load ctor. Builds a balanced bst from a range of key/value pairs.
+    /// 
+    /// @tparam It      forward iterator to std::pair<K,V> (or kvpair)
+    /// @param first    range begin
+    /// @param last     range end
+    /// @param order    how the range is ordered (default: sorted)
+    template< class It >
+    Bst(It first, It last, range_order order = range_order::sorted): Bst(){
+        assign(first,last,order);
+    }
+
+    ~Bst(){
+        clear();
+        delete share;
+    }
 
     // copy/move semantics ----------------------------------------------------
 
@@ -214,16 +659,21 @@ class Bst{
     /// Basically steals root, leaving moved bst in a valid state.
     /// @param bst bst to steal
     Bst(Bst&& bst):
+            alloc{std::move(bst.alloc)},
             root{bst.root},
+            last_node{bst.last_node},
             size{bst.size},
-            height{bst.height}{
+            share{bst.share},
+            unshareable{bst.unshareable}{
         if(root){
             if(root->l_child){root->l_child->parent = root;}
             if(root->r_child){root->r_child->parent = root;}
         }
         bst.root=nullptr;
+        bst.last_node=nullptr;
         bst.size=0;
-        bst.height=-1;
+        bst.share=nullptr;
+        bst.unshareable=false;
     }
 
     /// @brief Move assignment.
@@ -234,15 +684,28 @@ class Bst{
     /// @return Bst& *this after steal
     Bst& operator=(Bst&& rhs);
 
-    /// @brief Deep-copy ctor.
+    /// @brief Deep-copy ctor. With copy_on_write, O(1): the copy shares the nodes of bst
+    ///        until either tree changes (unless bst handed out non-const iterators or
+    ///        references since it was last cleared: the copy is deep then).
     /// 
     /// @param bst BST to copy
-    Bst(const Bst& bst):
-            root{bst.root?new Node{*bst.root}:nullptr},
-            size{bst.size},
-            height{bst.height}{};
+    Bst(const Bst& bst): Bst(){
+        if(can_share(bst)){
+            share = join_share(bst);
+            root = bst.root;
+            last_node = bst.last_node;
+        }
+        else{
+            // a deep copy owns its nodes alone, but still needs a share count if copy_on_write
+            if(copy_on_write && bst.root){ share = new cow_share;}
+            root = copy_subtree(bst.root,bst.size);
+            last_node = rightmost(root);
+        }
+        size = bst.size;
+    }
 
-    /// @brief Deep-copy assignment.
+    /// @brief Deep-copy assignment. With copy_on_write, O(1) (plus letting the old nodes go),
+    ///        except when the copy ctor would copy deeply too.
     /// 
     /// @param rhs      BST to copy
     /// @return Bst&    *this after copy
@@ -270,7 +733,7 @@ class Bst{
 
   public:
     
-    inline iterator begin(){ return _begin<iterator>();}
+    inline iterator begin(){ hand_out(); return _begin<iterator>();}
     inline const_iterator begin() const{ return _begin<const_iterator>();}
     inline const_iterator cbegin() const{ return _begin<const_iterator>();}
 
@@ -282,6 +745,58 @@ class Bst{
     // Node insertion
     //---------------
 
+  private:
+
+    /// @brief Looks for key by descent from root (or from the root of a subtree
+    ///        which is known to hold key's position).
+    /// 
+    /// @param key      key to look for
+    /// @param parent   (out) if key is not found, node the new one should be linked to (nullptr: empty tree)
+    /// @param left     (out) if key is not found, whether it should be linked as left child
+    /// @param from     where the descent starts (nullptr: root)
+    /// @return Node*   node holding key, nullptr if not found
+    Node* find_position(const K& key, Node*& parent, bool& left, Node* from = nullptr) const;
+
+    /// @brief Finger search: same as find_position() but starting from a node
+    ///        (supposedly) close to key. Climbs up until an ancestor whose subtree
+    ///        holds key's position is met, then descends from it.
+    ///        O(log(d)) on balanced trees, d being the distance from finger to key.
+    /// 
+    /// @param finger   starting node (nullptr: root)
+    /// @param key      key to look for
+    /// @param parent   (out) see find_position()
+    /// @param left     (out) see find_position()
+    /// @return Node*   node holding key, nullptr if not found
+    Node* find_position_near(Node* finger, const K& key, Node*& parent, bool& left) const;
+
+    /// @brief Same as find_position() but checks first whether key fits right
+    ///        before the hint, falling back to a finger search from it if it does not.
+    ///        O(1) amortised when the hint is right.
+    /// 
+    /// @param hint     node the key should precede (nullptr: end())
+    /// @param key      key to look for
+    /// @param parent   (out) see find_position()
+    /// @param left     (out) see find_position()
+    /// @return Node*   node holding key, nullptr if not found
+    Node* find_hint_position(Node* hint, const K& key, Node*& parent, bool& left) const;
+
+    /// @brief Links a new node where find_position() told and updates tree stats
+    ///        (the balancing policy is applied as well).
+    /// 
+    /// @param n        new node
+    /// @param parent   node to link n to (nullptr: n becomes root)
+    /// @param left     whether n is the left child of parent
+    void attach_node(Node* n, Node* parent, bool left) noexcept;
+
+    /// @brief Unpacks the tuples of a piecewise emplace: builds the key, then try_emplace()s.
+    template< class... KArgs, class... VArgs, std::size_t... KI, std::size_t... VI >
+    std::pair<iterator, bool> emplace_piecewise(std::tuple<KArgs...>& kargs, std::tuple<VArgs...>& vargs, std::index_sequence<KI...>, std::index_sequence<VI...>){
+        K key(std::get<KI>(std::move(kargs))...);
+        return try_emplace(std::move(key), std::get<VI>(std::move(vargs))...);
+    }
+
+  public:
+
 
     /// @brief Inserts a new node in the tree by moving given key/value pair.
     ///
@@ -301,15 +816,182 @@ class Bst{
 
     /// @brief Inserts a new node in the tree by creating it in place from given args.
     /// 
-    /// If given key is already used the tree is left unchanged.
+    /// If given key is already used the tree is left unchanged (and the value is not built).
+    /// The value is list-initialised (V{vctorargs...}), then moved into the new node:
+    /// try_emplace() builds it in place with parentheses instead.
     /// 
     /// @tparam vctorargtypes   argument types of V ctor 
     /// @param key              key value to insert the element at (if not present)
-    /// @param vctorargs        values forwarded to V ctor (these are moved!)
+    /// @param vctorargs        values forwarded to V ctor
     /// @return std::pair<iterator, bool> iterator to element at given key + if insertion was successful
     template< class... vctorargtypes >
     std::pair<iterator, bool> emplace(const K& key, vctorargtypes&&... vctorargs);
 
+    /// @brief Piecewise emplace: key and value are built from the args in each tuple.
+    ///
+    /// The key is built first (it is needed by the descent); the value is built
+    /// in place inside the new node, only if the key is not present.
+    /// 
+    /// @param kargs    arguments of K ctor (e.g. std::forward_as_tuple(...))
+    /// @param vargs    arguments of V ctor
+    /// @return std::pair<iterator, bool> iterator to element at given key + if insertion was successful
+    template< class... KArgs, class... VArgs >
+    std::pair<iterator, bool> emplace(std::piecewise_construct_t, std::tuple<KArgs...> kargs, std::tuple<VArgs...> vargs){
+        return emplace_piecewise(kargs,vargs,std::index_sequence_for<KArgs...>{},std::index_sequence_for<VArgs...>{});
+    }
+
+    /// @brief Inserts a new element whose value is built in place inside the new node from given args.
+    ///
+    /// The tree is searched first: if key is already used nothing is built
+    /// (nor are args moved from) and the tree is left unchanged.
+    /// The value is built as V(vctorargs...), as std::map does, not with braces as emplace().
+    /// 
+    /// @tparam vctorargtypes   argument types of V ctor 
+    /// @param key              key value to insert the element at (if not present)
+    /// @param vctorargs        values forwarded to V ctor
+    /// @return std::pair<iterator, bool> iterator to element at given key + if insertion was successful
+    template< class... vctorargtypes >
+    std::pair<iterator, bool> try_emplace(const K& key, vctorargtypes&&... vctorargs);
+
+    /// @brief As try_emplace(const K&, ...), the key is moved into the new node (only if inserted).
+    template< class... vctorargtypes >
+    std::pair<iterator, bool> try_emplace(K&& key, vctorargtypes&&... vctorargs);
+
+    /// @brief Assigns obj to the value at given key, or inserts a new element
+    ///        whose value is built in place from obj if key is not present.
+    /// 
+    /// @tparam M       type of the new value (V must be assignable and constructible from it)
+    /// @param key      key of the element
+    /// @param obj      new value
+    /// @return std::pair<iterator, bool> iterator to element at given key + if insertion took place
+    template< class M >
+    std::pair<iterator, bool> insert_or_assign(const K& key, M&& obj);
+
+    /// @brief As insert_or_assign(const K&, M&&), the key is moved into the new node (only if inserted).
+    template< class M >
+    std::pair<iterator, bool> insert_or_assign(K&& key, M&& obj);
+
+    /// @brief Hinted insertion (by move).
+    ///
+    /// If key fits right before hint the descent from root is skipped, so on avl trees
+    /// without order_stats feeding (nearly) sorted keys with end() as hint costs O(1) amortised
+    /// per insertion. The path above the new node is still walked to refresh heights (and
+    /// subtree sizes): with order_stats each insertion costs O(log N), and on unbalanced trees,
+    /// where sorted keys make a vine whose every height grows, O(N) as without a hint.
+    /// If given key is already used the tree is left unchanged.
+    /// 
+    /// @param hint         position the new element should precede
+    /// @param kv           key/value pair to move
+    /// @return iterator    iterator to element at given key
+    iterator insert(const_iterator hint, kvpair&& kv);
+
+    /// @brief Hinted insertion (by copy). See insert(const_iterator, kvpair&&).
+    /// 
+    /// @param hint         position the new element should precede
+    /// @param kv           key/value pair to copy
+    /// @return iterator    iterator to element at given key
+    iterator insert(const_iterator hint, const kvpair& kv){ return insert(hint,kvpair{kv});}
+
+    /// @brief Hinted emplace. See insert(const_iterator, kvpair&&).
+    ///
+    /// The value is only built if the key is not present, list-initialised as by emplace().
+    /// 
+    /// @tparam vctorargtypes   argument types of V ctor 
+    /// @param hint             position the new element should precede
+    /// @param key              key value to insert the element at (if not present)
+    /// @param vctorargs        values forwarded to V ctor
+    /// @return iterator        iterator to element at given key
+    template< class... vctorargtypes >
+    iterator emplace_hint(const_iterator hint, const K& key, vctorargtypes&&... vctorargs);
+
+    //----------
+    // Bulk load
+    //----------
+
+  private:
+
+    /// @brief Recursively builds a balanced subtree out of the next n (distinct) pairs of a sorted range.
+    ///        Pairs are consumed in order: left subtree, subtree root, right subtree.
+    /// 
+    /// @tparam It      forward iterator to std::pair<K,V> (or kvpair)
+    /// @param it       current position in the range (advanced past the consumed pairs)
+    /// @param last     range end
+    /// @param n        number of distinct keys to consume
+    /// @param dedup    if true, pairs whose key equals the previous one are skipped
+    /// @return Node*   root of the subtree (parent link is left to the caller)
+    template< class It >
+    Node* build_sorted_rec(It& it, const It& last, unsigned int n, bool dedup);
+
+    /// @brief Orders buffered pairs by key.
+    static bool pair_less(const std::pair<K,V>& a, const std::pair<K,V>& b){ return cmp()(a.first,b.first);}
+
+    /// @brief Stable merge of the sorted ranges [a,a_end) and [b,b_end) into out (pairs are moved).
+    ///        The longer range is cut in half and the other one where its middle key would go,
+    ///        and the two merges that are left run on different threads.
+    /// 
+    /// @param out      room for all the pairs of both ranges (not overlapping them)
+    /// @param threads  threads available
+    static void parallel_merge(std::pair<K,V>* a, std::pair<K,V>* a_end,
+                               std::pair<K,V>* b, std::pair<K,V>* b_end,
+                               std::pair<K,V>* out, unsigned int threads);
+
+    /// @brief Stable merge sort of n pairs, both halves sorted on different threads,
+    ///        then merged by parallel_merge(). Halves are sorted into the buffer they are
+    ///        not merged into, so that pairs go back and forth between first and tmp.
+    /// 
+    /// @param first    pairs to sort
+    /// @param tmp      room for n pairs
+    /// @param n        number of pairs
+    /// @param to_tmp   whether sorted pairs should end up in tmp (in first otherwise)
+    /// @param threads  threads available
+    static void parallel_sort(std::pair<K,V>* first, std::pair<K,V>* tmp, std::size_t n,
+                              bool to_tmp, unsigned int threads);
+
+    /// @brief Runs f(lo), f(lo+1)... f(hi-1), split among threads.
+    template< class F >
+    static void parallel_for(std::size_t lo, std::size_t hi, unsigned int threads, F f);
+
+    /// @brief Builds a balanced subtree out of n sorted distinct pairs (moved from),
+    ///        whose two halves are built on different threads and then linked below the middle pair.
+    ///        Same shape as build_sorted_rec().
+    /// 
+    /// @param first    pairs to build from
+    /// @param n        number of pairs
+    /// @param threads  threads available
+    /// @return Node*   root of the subtree (parentless)
+    Node* build_parallel_rec(std::pair<K,V>* first, unsigned int n, unsigned int threads);
+
+  public:
+
+    /// @brief Replaces the content of the tree with a balanced bst built from
+    ///        a range of key/value pairs.
+    ///
+    /// Sorted ranges are laid out in one linear pass (the median of each sub-range
+    /// becomes the root of the corresponding subtree), unsorted ones are copied
+    /// and sorted first.
+    /// 
+    /// @tparam It      forward iterator to std::pair<K,V> (or kvpair)
+    /// @param first    range begin
+    /// @param last     range end
+    /// @param order    how the range is ordered (default: sorted)
+    template< class It >
+    void assign(It first, It last, range_order order = range_order::sorted);
+
+    /// @brief Builds a balanced bst from an unsorted range of key/value pairs using many threads:
+    ///        pairs are copied, merge sorted in parallel, deduplicated in parallel (the first
+    ///        pair of each key is kept) and the two halves of every subtree are built on different
+    ///        threads, then linked below their middle node. Same result as
+    ///        assign(first,last,range_order::unsorted); K and V must be default constructible.
+    ///        With an arena the nodes are allocated by a single thread.
+    /// 
+    /// @tparam It      forward iterator to std::pair<K,V> (or kvpair)
+    /// @param first    range begin
+    /// @param last     range end
+    /// @param threads  most threads to use (default: all cores)
+    /// @return Bst     the new tree
+    template< class It >
+    static Bst build_parallel(It first, It last, unsigned int threads = std::thread::hardware_concurrency());
+
     //------------
     // Node access
     //------------
@@ -319,18 +1001,23 @@ class Bst{
     /// @brief Base iterator find method.
     /// 
     /// @tparam It      iterator or const_iterator
+    /// @tparam KT      K or any type cmp can compare with K (transparent cmp)
     /// @param key      Key to find
     /// @return It      Iterator to node "key" (or nullptr if not found)
-    template<class It>
-    It _find(const K& key) const;
+    template<class It, class KT>
+    It _find(const KT& key) const;
 
   public:
 
+    // Overloads taking a generic KT are only enabled when cmp declares
+    // is_transparent (e.g. std::less<>), so that keys need not be materialised
+    // to be looked up (e.g. const char* probes on std::string keys).
+
     /// @brief returns an iterator to given key (or to end() if none was found).
     /// 
     /// @param key        key to find
     /// @return iterator  iterator to value found (or end() if key is not present)
-    inline iterator find(const K& key){ return _find<iterator>(key);}
+    inline iterator find(const K& key){ hand_out(); return _find<iterator>(key);}
     
     /// @brief returns an iterator to given key (or to end() if none was found).
     /// 
@@ -338,87 +1025,425 @@ class Bst{
     /// @return iterator  iterator to value found (or end() if key is not present)
     inline const_iterator find(const K& key) const{ return _find<const_iterator>(key);};
 
-    /// @brief returns a r/w reference to value at given key (eventually initializing it).
+    /// @brief Heterogeneous find (transparent cmp only). See find(const K&).
     /// 
-    /// @param key        key of the element to return
-    /// @return V&        reference to the element at key (initializes it if not present already)
-    V& operator[](K&& key);
-    
-    /// @brief returns a r/w reference to value at given key (eventually initializing it).
+    /// @param key        value comparable with keys
+    /// @return iterator  iterator to value found (or end() if key is not present)
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline iterator find(const KT& key){ hand_out(); return _find<iterator>(key);}
+
+    /// @brief Heterogeneous find (transparent cmp only). See find(const K&).
     /// 
-    /// @param key        key of the element to return
-    /// @return V&        reference to the element at key (initializes it if not present already)
-    V& operator[](const K& key);
+    /// @param key              value comparable with keys
+    /// @return const_iterator  iterator to value found (or end() if key is not present)
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline const_iterator find(const KT& key) const{ return _find<const_iterator>(key);}
 
-    //-------------
-    // Node removal
-    //-------------
+    /// @brief Whether given key is present.
+    /// 
+    /// @param key      key to look for
+    /// @return true    if key is present
+    /// @return false   ... otherwise
+    inline bool contains(const K& key) const{ return _find<const_iterator>(key)!=cend();}
+
+    /// @brief Heterogeneous contains (transparent cmp only). See contains(const K&).
+    /// 
+    /// @param key      value comparable with keys
+    /// @return true    if an equivalent key is present
+    /// @return false   ... otherwise
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline bool contains(const KT& key) const{ return _find<const_iterator>(key)!=cend();}
+
+    //--------------
+    // Range queries
+    //--------------
 
   private:
-    
-    /// @brief Helper method that performs node deletion recursively;
-    ///        BST structure is preserved.
+
+    /// @brief First node whose key is not less than key.
     /// 
-    /// @param n node to delete
-    void erase_node(Node* n);
-  public:
+    /// @param key      bound
+    /// @return Node*   node found (nullptr if every key is < key)
+    template< class KT >
+    Node* lower_bound_node(const KT& key) const;
 
-    /// @brief Remove the element at given key (if present) while preserving bst structure.
+    /// @brief First node whose key is greater than key.
     /// 
-    /// @param key Key of the element to remove
-    void erase(const K& key);
+    /// @param key      bound
+    /// @return Node*   node found (nullptr if every key is <= key)
+    template< class KT >
+    Node* upper_bound_node(const KT& key) const;
 
-    /// @brief Clears the content of the tree.
+    /// @brief Lightweight view over the elements between two iterators,
+    ///        so that a range can be used in a range-for loop.
     /// 
-    void clear();
+    /// @tparam It iterator or const_iterator
+    template<class It>
+    class _range{
+        It first;
+        It last;
 
-    //-------
-    // Output
-    //-------
+      public:
+        _range(It p_first, It p_last): first{p_first}, last{p_last}{};
 
-    /// @brief Getter for bst size.
+        It begin() const{ return first;}
+        It end() const{ return last;}
+
+        /// @brief Whether the view holds no elements.
+        bool empty() const{ return first==last;}
+    };
+
+  public:
+
+    typedef _range<iterator> range_type;
+    typedef _range<const_iterator> const_range_type;
+
+    /// @brief Returns an iterator to the first element whose key is not less than key. O(height).
     /// 
-    /// @return unsigned int bst's size
-    unsigned int get_size() const noexcept{return size;}
+    /// @param key        bound
+    /// @return iterator  iterator to the element found (or end())
+    inline iterator lower_bound(const K& key){ hand_out(); return iterator{lower_bound_node(key)};}
 
-    /// @brief Getter for bst height.
+    /// @brief Returns an iterator to the first element whose key is not less than key. O(height).
     /// 
-    /// @return int tree's height
-    int get_height() const noexcept{return height;}
-    
-    //TODO: const this?
-    /// @brief Sends string representation of bst to ostream.
+    /// @param key              bound
+    /// @return const_iterator  iterator to the element found (or end())
+    inline const_iterator lower_bound(const K& key) const{ return const_iterator{lower_bound_node(key)};}
+
+    /// @brief Heterogeneous lower_bound (transparent cmp only). See lower_bound(const K&).
     /// 
-    /// @param os               output stream
-    /// @param bst              current object
-    /// @return std::ostream&   the ostream, to allow chained call
-    friend
-    std::ostream& operator<< (std::ostream& os, const Bst& bst){
-        os<<"size:"<<bst.size<<" height:"<<bst.height<<"\n";
-        for (auto& kv:bst){
-            os<<"("<<kv.first<<","<<kv.second<<") ";
-        }
-        return os;
-    }
-    
-  private:
+    /// @param key        value comparable with keys
+    /// @return iterator  iterator to the element found (or end())
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline iterator lower_bound(const KT& key){ hand_out(); return iterator{lower_bound_node(key)};}
 
+    /// @brief Heterogeneous lower_bound (transparent cmp only). See lower_bound(const K&).
+    /// 
+    /// @param key              value comparable with keys
+    /// @return const_iterator  iterator to the element found (or end())
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline const_iterator lower_bound(const KT& key) const{ return const_iterator{lower_bound_node(key)};}
 
-    /// @brief Returns a string representation of a kvpair.
+    /// @brief Returns an iterator to the first element whose key is greater than key. O(height).
     /// 
-    /// @param kv 
-    /// @return std::string 
-    std::string kv_to_str(kvpair &kv);
+    /// @param key        bound
+    /// @return iterator  iterator to the element found (or end())
+    inline iterator upper_bound(const K& key){ hand_out(); return iterator{upper_bound_node(key)};}
 
-    /// @brief Returns the string representation of a node in the form "[key]:[value]".
+    /// @brief Returns an iterator to the first element whose key is greater than key. O(height).
     /// 
-    /// @param n            pointer to the node to print
-    /// @param def          default string to use when input is nullptr
-    /// @param key_only     if True, the output string is only "[key]"
-    /// @return std::string "[key]:[value]" string representation of the node.
-    std::string node_to_str(Node* n, std::string def = ".", bool key_only = false);
+    /// @param key              bound
+    /// @return const_iterator  iterator to the element found (or end())
+    inline const_iterator upper_bound(const K& key) const{ return const_iterator{upper_bound_node(key)};}
 
-    /// @brief Recursively populates the Node** array given in input
+    /// @brief Heterogeneous upper_bound (transparent cmp only). See upper_bound(const K&).
+    /// 
+    /// @param key        value comparable with keys
+    /// @return iterator  iterator to the element found (or end())
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline iterator upper_bound(const KT& key){ hand_out(); return iterator{upper_bound_node(key)};}
+
+    /// @brief Heterogeneous upper_bound (transparent cmp only). See upper_bound(const K&).
+    /// 
+    /// @param key              value comparable with keys
+    /// @return const_iterator  iterator to the element found (or end())
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline const_iterator upper_bound(const KT& key) const{ return const_iterator{upper_bound_node(key)};}
+
+    /// @brief Returns the range of elements whose key is equivalent to key
+    ///        (at most one, as keys are unique).
+    /// 
+    /// @param key  key to look for
+    /// @return std::pair<iterator,iterator> lower_bound(key), upper_bound(key)
+    std::pair<iterator,iterator> equal_range(const K& key){
+        return std::make_pair(lower_bound(key),upper_bound(key));
+    }
+
+    /// @brief Returns the range of elements whose key is equivalent to key
+    ///        (at most one, as keys are unique).
+    /// 
+    /// @param key  key to look for
+    /// @return std::pair<const_iterator,const_iterator> lower_bound(key), upper_bound(key)
+    std::pair<const_iterator,const_iterator> equal_range(const K& key) const{
+        return std::make_pair(lower_bound(key),upper_bound(key));
+    }
+
+    /// @brief Returns a view over the elements whose key lies in [lo,hi),
+    ///        to be used in range-for loops. Two O(height) descents, no copy.
+    /// 
+    /// @param lo           lower bound (included)
+    /// @param hi           upper bound (excluded)
+    /// @return range_type  view over the elements (empty if !(lo<hi))
+    range_type range(const K& lo, const K& hi){
+        iterator first{lower_bound(lo)};
+        return range_type{first, cmp()(lo,hi)? lower_bound(hi) : first};
+    }
+
+    /// @brief Returns a read-only view over the elements whose key lies in [lo,hi).
+    ///        See range().
+    /// 
+    /// @param lo                   lower bound (included)
+    /// @param hi                   upper bound (excluded)
+    /// @return const_range_type    view over the elements (empty if !(lo<hi))
+    const_range_type range(const K& lo, const K& hi) const{
+        const_iterator first{lower_bound(lo)};
+        return const_range_type{first, cmp()(lo,hi)? lower_bound(hi) : first};
+    }
+
+    /// @brief returns a r/w reference to value at given key (eventually initializing it).
+    /// 
+    /// @param key        key of the element to return
+    /// @return V&        reference to the element at key (initializes it if not present already)
+    V& operator[](K&& key);
+    
+    /// @brief returns a r/w reference to value at given key (eventually initializing it).
+    /// 
+    /// @param key        key of the element to return
+    /// @return V&        reference to the element at key (initializes it if not present already)
+    V& operator[](const K& key);
+
+    //-----------------
+    // Order statistics
+    //-----------------
+
+  private:
+
+    /// @brief Base iterator nth method.
+    /// 
+    /// @tparam It      iterator or const_iterator
+    /// @param i        0-based position in cmp order
+    /// @return It      Iterator to the i-th smallest node (or nullptr if i>=size)
+    template<class It>
+    It _nth(unsigned int i) const;
+
+  public:
+
+    /// @brief Returns an iterator to the i-th smallest element. O(height).
+    ///        Requires order_stats.
+    /// 
+    /// @param i          0-based position in cmp order
+    /// @return iterator  iterator to the i-th element (or end() if i>=size)
+    inline iterator nth(unsigned int i){ hand_out(); return _nth<iterator>(i);}
+
+    /// @brief Returns an iterator to the i-th smallest element. O(height).
+    ///        Requires order_stats.
+    /// 
+    /// @param i                0-based position in cmp order
+    /// @return const_iterator  iterator to the i-th element (or end() if i>=size)
+    inline const_iterator nth(unsigned int i) const{ return _nth<const_iterator>(i);}
+
+    /// @brief Counts the keys smaller than given one (ie. the position key has,
+    ///        or would have, in cmp order). O(height). Requires order_stats.
+    /// 
+    /// @param key              key to rank (need not be present)
+    /// @return unsigned int    number of keys preceding key
+    unsigned int rank(const K& key) const;
+
+    /// @brief Counts the keys in [lo,hi). O(height). Requires order_stats.
+    /// 
+    /// @param lo               lower bound (included)
+    /// @param hi               upper bound (excluded)
+    /// @return unsigned int    number of keys k such that !(k<lo) && k<hi
+    unsigned int count_range(const K& lo, const K& hi) const{
+        return cmp()(lo,hi)? rank(hi)-rank(lo) : 0;
+    }
+
+    //-------------
+    // Node removal
+    //-------------
+
+  private:
+    
+    /// @brief Helper method that performs node deletion;
+    ///        BST structure is preserved.
+    ///
+    /// Nodes are only relinked (a node with two children is replaced by its successor node),
+    /// hence no allocation nor kvpair copy takes place and other iterators stay valid.
+    /// 
+    /// @param n node to delete (nothing happens if nullptr)
+    void erase_node(Node* n){
+        if(n){
+            unlink_node(n);
+            destroy_node(n);
+        }
+    }
+
+    /// @brief Takes a node out of the tree, as erase_node() does, but leaves it alive:
+    ///        it comes out parentless and childless, ready to be linked again.
+    /// 
+    /// @param n node to unlink (not nullptr)
+    void unlink_node(Node* n) noexcept;
+  public:
+
+    /// @brief Remove the element at given key (if present) while preserving bst structure.
+    /// 
+    /// @param key Key of the element to remove
+    void erase(const K& key){
+        unshare();
+        erase_node(_find<iterator>(key).current);
+    }
+
+    /// @brief Heterogeneous erase (transparent cmp only). See erase(const K&).
+    /// 
+    /// @param key value comparable with keys
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    void erase(const KT& key){
+        unshare();
+        erase_node(_find<iterator>(key).current);
+    }
+
+    /// @brief Clears the content of the tree.
+    /// 
+    void clear();
+
+    //-------------
+    // Node handles
+    //-------------
+
+    /// @brief Owning handle to a node taken out of a tree by extract(), which insert(node_type&&)
+    ///        links into another tree of the same type as it is: no allocation, no copy of the element.
+    ///        If the handle still holds the node when it goes, the element is destroyed with it.
+    ///        Nodes change tree, hence handles need a stateless allocation policy (e.g. heap_allocator).
+    class node_type{
+
+        Node* n{nullptr};
+
+        friend class Bst;
+
+        explicit node_type(Node* p) noexcept: n{p}{}
+
+        /// @brief Destroys the node held, if any.
+        void reset() noexcept{
+            if(n){
+                n->~Node();
+                Alloc<Node>{}.deallocate(n);
+                n = nullptr;
+            }
+        }
+
+      public:
+        using key_type = K;
+        using mapped_type = V;
+
+        node_type() noexcept = default;
+        node_type(node_type&& h) noexcept: n{h.n}{ h.n = nullptr;}
+        node_type& operator=(node_type&& h) noexcept{
+            if(this!=&h){
+                reset();
+                n = h.n;
+                h.n = nullptr;
+            }
+            return *this;
+        }
+        node_type(const node_type&) = delete;
+        node_type& operator=(const node_type&) = delete;
+        ~node_type(){ reset();}
+
+        /// @brief Whether the handle holds no node.
+        bool empty() const noexcept{ return n==nullptr;}
+        explicit operator bool() const noexcept{ return n!=nullptr;}
+
+        /// @brief Key of the element held (handle must not be empty).
+        const K& key() const{ return n->kv.first;}
+
+        /// @brief Value of the element held (handle must not be empty).
+        V& mapped() const{ return n->kv.second;}
+    };
+
+    /// @brief Outcome of insert(node_type&&).
+    struct insert_return_type{
+        iterator position;  ///< element inserted, or already holding the key (end() for an empty handle)
+        bool inserted;      ///< whether the node was linked
+        node_type node;     ///< the node, if not linked (empty otherwise)
+    };
+
+    /// @brief Takes the element at pos out of the tree, without destroying it. O(height).
+    ///        Iterators to the other elements stay valid (unless copy_on_write, see Bst).
+    /// 
+    /// @param pos          element to extract (not end())
+    /// @return node_type   handle owning the element
+    node_type extract(const_iterator pos);
+
+    /// @brief Takes the element at key out of the tree, if present. See extract(const_iterator).
+    /// 
+    /// @param key          key of the element to extract
+    /// @return node_type   handle owning the element (empty if key is not present)
+    node_type extract(const K& key){
+        unshare();
+        Node* n{_find<iterator>(key).current};
+        if(n==nullptr){ return node_type{};}
+        return extract(const_iterator{n});
+    }
+
+    /// @brief Links the node of a handle into the tree, unless its key is present already
+    ///        (then the handle keeps it). Nothing is allocated nor copied.
+    /// 
+    /// @param nh                   handle to take the node from
+    /// @return insert_return_type  where the element is, whether it was linked, and the node if not
+    insert_return_type insert(node_type&& nh);
+
+    /// @brief Hinted insert(node_type&&), see insert(const_iterator, kvpair&&):
+    ///        if the key is present, the handle keeps the node.
+    /// 
+    /// @param hint     position the element should precede
+    /// @param nh       handle to take the node from
+    /// @return iterator element at the key of the node (end() for an empty handle)
+    iterator insert(const_iterator hint, node_type&& nh);
+
+    /// @brief Moves into this tree the nodes of src whose key is not here yet; the others
+    ///        stay in src. Nothing is allocated nor copied. O(M log(N+M)).
+    /// 
+    /// @param src tree to take the nodes from
+    void merge(Bst& src);
+    void merge(Bst&& src){ merge(src);}
+
+    //-------
+    // Output
+    //-------
+
+    /// @brief Getter for bst size.
+    /// 
+    /// @return unsigned int bst's size
+    unsigned int get_size() const noexcept{return size;}
+
+    /// @brief Getter for bst height. O(1), as every node keeps track of its subtree height.
+    /// 
+    /// @return int tree's height
+    int get_height() const noexcept{return node_height(root);}
+    
+    //TODO: const this?
+    /// @brief Sends string representation of bst to ostream.
+    /// 
+    /// @param os               output stream
+    /// @param bst              current object
+    /// @return std::ostream&   the ostream, to allow chained call
+    friend
+    std::ostream& operator<< (std::ostream& os, const Bst& bst){
+        os<<"size:"<<bst.size<<" height:"<<bst.get_height()<<"\n";
+        for (auto& kv:bst){
+            os<<"("<<kv.first<<","<<kv.second<<") ";
+        }
+        return os;
+    }
+    
+  private:
+
+
+    /// @brief Returns a string representation of a kvpair.
+    /// 
+    /// @param kv 
+    /// @return std::string 
+    std::string kv_to_str(kvpair &kv);
+
+    /// @brief Returns the string representation of a node in the form "[key]:[value]".
+    /// 
+    /// @param n            pointer to the node to print
+    /// @param def          default string to use when input is nullptr
+    /// @param key_only     if True, the output string is only "[key]"
+    /// @return std::string "[key]:[value]" string representation of the node.
+    std::string node_to_str(Node* n, std::string def = ".", bool key_only = false);
+
+    /// @brief Recursively populates the Node** array given in input
     ///        to hold pointers to the nodes at a given depth.
     /// @param first Array to populate. it MUST HAVE BEEN ALLOCATED of size (at least) 2^depth.
     /// @param n     Root of the subtree whose height is depth and whose 
@@ -445,20 +1470,146 @@ class Bst{
     //--------
   private:
 
-    /// @brief Builds a balanced bst by recursive insertion of the middle point.
+    /// @brief Turns the tree into a "vine" (every node is the right child of
+    ///        its predecessor) by right rotations. First phase of balance().
+    void tree_to_vine() noexcept;
+
+    /// @brief Performs count left rotations on every other node of the right spine,
+    ///        starting from root. Building block of balance().
     /// 
-    /// @param kvs Sorted array of pointers to kvpairs
-    /// @param out Empty bst to be orderly filled with kvpairs
-    /// @param s   index of the first kvs element to consider
-    /// @param f   index of the last kvs element to consider (length-1 at step 0)
-    void balance_rec(kvpair**& kvs, Bst& out, int s, int f);
+    /// @param count number of rotations
+    void compress(unsigned int count) noexcept;
+
+    /// @brief Recomputes the height of every node by a post-order walk
+    ///        that follows parent links (O(N) time, O(1) memory).
+    void recompute_heights() noexcept;
   
   public:
-    /// @brief Balances the tree by replacing it with one built
-    ///        by laying the original nodes in a cmp() ordered sequence
-    ///        and recursively inserting the median node, and that of the
-    ///        left and right residual sequences.
-    void balance();
+    /// @brief Balances the tree in place with the Day-Stout-Warren algorithm:
+    ///        nodes are first rotated into a sorted vine, which is then
+    ///        compressed into a tree whose levels are all full except (maybe) the last one.
+    ///        O(N) time and O(1) extra memory: nodes are just relinked,
+    ///        no allocation nor copy of kvpairs takes place, hence iterators stay valid
+    ///        (unless copy_on_write: as every change, it invalidates them, see Bst).
+    void balance() noexcept(!copy_on_write);
+
+    //-------------------------------
+    // Split, join and set operations
+    //-------------------------------
+
+    // Nodes move between trees, so that nothing is allocated nor copied: split(), join() and
+    // merge_from() need a stateless allocation policy (e.g. heap_allocator). intersect() and
+    // difference() only ever free nodes of their own tree; with an arena, they run on one thread.
+
+    /// @brief Moves the elements whose key is not less than key into a new tree, this tree keeps
+    ///        the others. O(log N) for avl trees, O(height) otherwise; without order_stats, the
+    ///        sizes of the two parts are counted too, in O(size of the smaller one).
+    /// 
+    /// @param key  key to split at
+    /// @return Bst tree of the elements with key >= key
+    Bst split(const K& key);
+
+    /// @brief Joins two trees and an element whose key lies between theirs. O(log N) for avl trees
+    ///        (the result is balanced), O(1) otherwise.
+    /// 
+    /// @param left     tree of the smaller keys (left empty)
+    /// @param mid      element in between
+    /// @param right    tree of the greater keys (left empty)
+    /// @return Bst     tree holding every element
+    /// @throw std::invalid_argument if keys are not in order (nothing changes then)
+    static Bst join(Bst&& left, kvpair mid, Bst&& right);
+
+    /// @brief Moves every element of other into this tree (set union); where both have a key,
+    ///        the element of other replaces the one of this tree. other is left empty.
+    ///        Join-based divide and conquer on the M elements of other, whose two halves run
+    ///        on different threads: O(M log(N/M+1)) work (avl trees), no node is allocated.
+    /// 
+    /// @param other    tree to merge in (typically the smaller one)
+    /// @param threads  most threads to use (default: all cores)
+    void merge_from(Bst&& other, unsigned int threads = std::thread::hardware_concurrency());
+
+    /// @brief Keeps only the elements whose key is also in other (set intersection).
+    ///        Same scheme and costs as merge_from().
+    /// 
+    /// @param other    tree whose keys are kept (not changed)
+    /// @param threads  most threads to use (default: all cores)
+    void intersect(const Bst& other, unsigned int threads = std::thread::hardware_concurrency());
+
+    /// @brief Removes the elements whose key is in other (set difference).
+    ///        Same scheme and costs as merge_from().
+    /// 
+    /// @param other    tree whose keys are removed (not changed)
+    /// @param threads  most threads to use (default: all cores)
+    void difference(const Bst& other, unsigned int threads = std::thread::hardware_concurrency());
+
+    //--------------------
+    // Parallel traversals
+    //--------------------
+
+  private:
+
+    /// @brief Cuts the tree into disjoint parts for parallel traversals: whole subtrees and
+    ///        single nodes between them, in key order. The tallest subtree is cut into its left
+    ///        subtree, its root alone and its right subtree until there are n_parts subtrees
+    ///        (or those left are shorter than 10 levels). Degenerate trees give up after a few cuts.
+    /// 
+    /// @param n_parts  number of subtrees to aim for
+    /// @return std::vector<std::pair<Node*,bool>> parts in key order: node and whether its whole subtree is meant
+    std::vector<std::pair<Node*,bool>> cut_tree(unsigned int n_parts) const;
+
+    /// @brief Calls f on every element of part, in key order.
+    template< class F >
+    static void for_part(const std::pair<Node*,bool>& part, F& f);
+
+  public:
+
+    /// @brief Default projection of parallel_reduce(): the value of an element.
+    struct value_of{
+        const V& operator()(const kvpair& kv) const{ return kv.second;}
+    };
+
+    /// @brief Calls f on every element, working on disjoint subtrees on different threads:
+    ///        f must be safe to call concurrently on different elements. No order is guaranteed.
+    ///        Keys cannot be changed, values can.
+    /// 
+    /// @tparam F       callable taking a kvpair&
+    /// @param f        function to call
+    /// @param threads  most threads to use (default: all cores)
+    template< class F >
+    void parallel_for_each(F f, unsigned int threads = std::thread::hardware_concurrency());
+
+    /// @brief Read-only parallel_for_each().
+    /// 
+    /// @tparam F       callable taking a const kvpair&
+    template< class F >
+    void parallel_for_each(F f, unsigned int threads = std::thread::hardware_concurrency()) const;
+
+    /// @brief Folds every element into init, in key order:
+    ///        op(...op(op(init,proj(e1)),proj(e2))...,proj(eN)). Disjoint subtrees are folded on
+    ///        different threads and their results combined in key order, so op only needs to be
+    ///        associative (not commutative).
+    /// 
+    /// @tparam T       result type
+    /// @tparam Op      callable taking two T and returning a T (associative)
+    /// @tparam Proj    callable taking a const kvpair& and returning (something convertible to) T
+    /// @param init     starting value (folded first)
+    /// @param op       binary operation
+    /// @param proj     what each element contributes (default: its value)
+    /// @param threads  most threads to use (default: all cores)
+    /// @return T       the result of the fold
+    template< class T, class Op, class Proj = value_of >
+    T parallel_reduce(T init, Op op, Proj proj = Proj{}, unsigned int threads = std::thread::hardware_concurrency()) const;
+
+    //---------
+    // Snapshot
+    //---------
+
+    /// @brief Builds an immutable snapshot of the tree, laid out for fast
+    ///        lookups (see FrozenBst). O(N), from a single in-order traversal.
+    ///        The snapshot is independent of the tree, which can keep changing.
+    /// 
+    /// @return FrozenBst<K,V,cmp> read-only copy of the content of the tree
+    FrozenBst<K,V,cmp> freeze() const{ return FrozenBst<K,V,cmp>(cbegin(),cend());}
 };
 
 
@@ -467,76 +1618,257 @@ class Bst{
 //#############################################################################
 
 //----
-//Node
+// bst
 //----
 
-template< class K, class V, class cmp>
-void Bst<K,V,cmp>::Node::delete_subtree_rec(){
-    if(l_child){
-        delete l_child;
-        l_child = nullptr;
+// node memory helpers
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class... Args >
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::create_node(Args&&... args){
+    Node* n{alloc.allocate()};
+    try{
+        new (n) Node{std::forward<Args>(args)...};
     }
-    if(r_child){
-        delete r_child;
-        r_child = nullptr;
+    catch(...){
+        alloc.deallocate(n);
+        throw;
     }
+    return n;
 }
 
-template< class K, class V, class cmp>
-Bst<K,V,cmp>::Node::Node(const Node& node):
-  kv{node.kv}{
-    
-    delete_subtree_rec();
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::copy_subtree(const Node* n, unsigned int n_nodes){
+    if(n==nullptr){
+        return nullptr;
+    }
+    alloc.reserve(n_nodes);
+
+    Node* cp_root{create_node(n->kv)};
+    cp_root->height = n->height;
+
+    // src and dst walk the two trees in lockstep
+    const Node* src{n};
+    Node* dst{cp_root};
+    try{
+        while(true){
+            // clone the left child first, then the right one...
+            if(src->l_child && dst->l_child==nullptr){
+                dst->l_child = create_node(src->l_child->kv);
+                dst->l_child->parent = dst;
+                src = src->l_child;
+                dst = dst->l_child;
+            }
+            else if(src->r_child && dst->r_child==nullptr){
+                dst->r_child = create_node(src->r_child->kv);
+                dst->r_child->parent = dst;
+                src = src->r_child;
+                dst = dst->r_child;
+            }
+            // ... then go back up (both subtrees done)
+            else{
+                update_count(dst);
+                if(src==n){ break;}
+                src = src->parent;
+                dst = dst->parent;
+                continue;
+            }
+            dst->height = src->height;
+        }
+    }
+    catch(...){
+        destroy_subtree(cp_root);
+        throw;
+    }
+    return cp_root;
+}
 
-    // clone descents (recursive call to copy ctor)
-    if(node.l_child){
-      l_child = new Node{*node.l_child};
-      l_child->parent = this;
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::destroy_subtree(Node* n) noexcept{
+    Node* stop{n->parent};
+    while(n!=stop){
+        // go down while possible...
+        if(n->l_child){ n = n->l_child;}
+        else if(n->r_child){ n = n->r_child;}
+        // ... destroy the leaf and detach it from its parent
+        else{
+            Node* p{n->parent};
+            if(p!=stop){
+                if(n==p->l_child){ p->l_child = nullptr;}
+                else{ p->r_child = nullptr;}
+            }
+            destroy_node(n);
+            n = p;
+        }
     }
-    if(node.r_child){
-      r_child = new Node{*node.r_child};
-      r_child->parent = this;
+}
+
+// copy-on-write
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::unshare(Node** finger, std::true_type){
+    if(share==nullptr){
+        share = new cow_share;
+        return;
     }
+    if(share->refs.load(std::memory_order_acquire)==1){
+        return;
+    }
+
+    // copy first: if it throws, nothing changed
+    cow_share* mine{new cow_share};
+    Node* cp{nullptr};
+    try{
+        cp = copy_subtree(root,size);
+    }
+    catch(...){
+        delete mine;
+        throw;
+    }
+
+    // switch to the copy, the finger moves to the same key in it
+    Node* old{root};
+    root = cp;
+    last_node = rightmost(root);
+    if(finger && *finger){
+        *finger = _find<iterator>((*finger)->kv.first).current;
+    }
+
+    // let the shared nodes go (the other trees may have let them go meanwhile)
+    if(share->refs.fetch_sub(1,std::memory_order_acq_rel)==1){
+        destroy_subtree(old);
+        delete share;
+    }
+    share = mine;
 }
 
-//----
-// bst
-//----
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+bool Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::leave_share(std::true_type) noexcept{
+    if(share && share->refs.load(std::memory_order_acquire)>1){
+        if(share->refs.fetch_sub(1,std::memory_order_acq_rel)>1){
+            share = nullptr;
+            return true;
+        }
+        // the others let go meanwhile: the nodes are ours again
+        share->refs.store(1,std::memory_order_relaxed);
+    }
+    return false;
+}
+
+// rotations
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::rotate_left_links(Node* n) noexcept{
+    Node* r{n->r_child};
+
+    // r's left subtree becomes n's right one
+    n->r_child = r->l_child;
+    if(n->r_child){ n->r_child->parent = n;}
+
+    // r takes n's place below n's parent
+    r->parent = n->parent;
+    if(n->parent){
+        if(n==n->parent->l_child){ n->parent->l_child = r;}
+        else{ n->parent->r_child = r;}
+    }
 
-// height helpers
+    // n goes below r
+    r->l_child = n;
+    n->parent = r;
 
-template< class K, class V, class cmp>
-int Bst<K,V,cmp>::compute_height_rec(Bst::Node* n) noexcept{
-    int hl{0},hr{0};
-    if(n->l_child){hl=1+compute_height_rec(n->l_child);}
-    if(n->r_child){hr=1+compute_height_rec(n->r_child);}
-    return hl>hr?hl:hr;
+    // r's subtree holds the very nodes n's did
+    update_count(n);
+    update_count(r);
+    return r;
 }
 
-template< class K, class V, class cmp>
-void Bst<K,V,cmp>::recompute_height() noexcept{
-    if(size==0){
-        height=-1;
-        return;
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::rotate_right_links(Node* n) noexcept{
+    Node* l{n->l_child};
+
+    // l's right subtree becomes n's left one
+    n->l_child = l->r_child;
+    if(n->l_child){ n->l_child->parent = n;}
+
+    // l takes n's place below n's parent
+    l->parent = n->parent;
+    if(n->parent){
+        if(n==n->parent->l_child){ n->parent->l_child = l;}
+        else{ n->parent->r_child = l;}
+    }
+
+    // n goes below l
+    l->r_child = n;
+    n->parent = l;
+
+    // l's subtree holds the very nodes n's did
+    update_count(n);
+    update_count(l);
+    return l;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::avl_rebalance(Node* n) noexcept{
+
+    while(n){
+        int old_height{n->height};
+        update_height(n);
+        int bf{node_height(n->l_child) - node_height(n->r_child)};
+
+        // left heavy
+        if(bf>1){
+            Node* l{n->l_child};
+            // left-right case: straighten first
+            if(node_height(l->l_child)<node_height(l->r_child)){
+                rotate_left(l);
+                update_height(l);
+            }
+            rotate_right(n);
+            update_height(n);
+            n = n->parent;
+            update_height(n);
+        }
+        // right heavy
+        else if(bf<-1){
+            Node* r{n->r_child};
+            // right-left case: straighten first
+            if(node_height(r->r_child)<node_height(r->l_child)){
+                rotate_right(r);
+                update_height(r);
+            }
+            rotate_left(n);
+            update_height(n);
+            n = n->parent;
+            update_height(n);
+        }
+
+        // subtree height unchanged: nothing to do upwards
+        if(n->height==old_height){
+            break;
+        }
+        n = n->parent;
     }
-    height=compute_height_rec(root);
 }
 
 // operator=
 
-template< class K, class V, class cmp>
-Bst<K,V,cmp>& Bst<K,V,cmp>::operator=(Bst&& rhs){
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>& Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::operator=(Bst&& rhs){
 
     // Self equality check before doing anything
     if(this != &rhs){
 
         // clear the tree 
-        if(root){delete root;} //TODO: use clear()
+        clear();
 
-        // Copy root and stats
+        // Take over their node store (and share count), copy root and stats
+        alloc = std::move(rhs.alloc);
+        delete share;
+        share = rhs.share;
+        unshareable = rhs.unshareable;
         root = rhs.root;
+        last_node = rhs.last_node;
         size = rhs.size;
-        height = rhs.height;
 
         // steal their children 
         if(root){
@@ -546,31 +1878,43 @@ Bst<K,V,cmp>& Bst<K,V,cmp>::operator=(Bst&& rhs){
 
         // clean rhs
         rhs.root=nullptr;
+        rhs.last_node=nullptr;
         rhs.size=0;
-        rhs.height=-1;
+        rhs.share=nullptr;
+        rhs.unshareable=false;
     }
     return *this;
 }
 
-template< class K, class V, class cmp>
-Bst<K,V,cmp>& Bst<K,V,cmp>::operator=(const Bst& rhs){
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>& Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::operator=(const Bst& rhs){
     if(this != &rhs){
         // clear  
-        if(root){delete root;} //TODO: use clear
-
-        // Perform the deep copy and also copy stats
-        root = rhs.root?new Node{*rhs.root}:nullptr;
+        clear();
+
+        // Share their nodes, or perform the deep copy, and also copy stats
+        if(can_share(rhs)){
+            cow_share* s{join_share(rhs)};
+            delete share;
+            share = s;
+            root = rhs.root;
+            last_node = rhs.last_node;
+        }
+        else{
+            if(copy_on_write && rhs.root && share==nullptr){ share = new cow_share;}
+            root = copy_subtree(rhs.root,rhs.size);
+            last_node = rightmost(root);
+        }
         size = rhs.size;
-        height = rhs.height;
     }
     return *this;
 }
 
 // iterators
 
-template< class K, class V, class cmp>
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
 template< class It>
-It Bst<K,V,cmp>::_begin() const{
+It Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::_begin() const{
     Node* first{root};
     if(first){
         while(first->l_child){
@@ -582,116 +1926,478 @@ It Bst<K,V,cmp>::_begin() const{
 
 // insertion
 
-template< class K, class V, class cmp>
-std::pair<typename Bst< K, V, cmp>::iterator, bool > Bst<K,V,cmp>::insert(Bst::kvpair&& kv){
-    Node* target_parent{root};
-    
-    // root
-    if(target_parent==nullptr){
-        root = new Node{kv};
-        size=1;
-        height=0;
-        return std::make_pair(Bst::iterator{root},true);
-    }
-
-    int new_height{1};
-    Node *target{nullptr};
-    while(target_parent){
-        // <
-        if(cmp()(kv.first,target_parent->kv.first) &&
-           !cmp()(target_parent->kv.first, kv.first)){
-            if(target_parent->l_child){
-                target_parent = target_parent->l_child;
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::find_position(const K& key, Node*& parent, bool& left, Node* from) const{
+    Node* target{from? from : root};
+    parent = nullptr;
+    left = false;
+    while(target){
+        int c{compare_keys<cmp>(key,target->kv.first)};
+        //=
+        if(c==0){ return target;}
+        parent = target;
+        left = c<0;
+        target = left? target->l_child : target->r_child;
+    }
+    return nullptr;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::find_hint_position(Node* hint, const K& key, Node*& parent, bool& left) const{
+
+    // key must be > the node before hint...
+    Node* prev{hint? select_prev_node(hint) : last_node};
+    if(prev==nullptr || cmp()(prev->kv.first,key)){
+
+        // ... and < hint
+        if(hint==nullptr || cmp()(key,hint->kv.first)){
+
+            // The gap between prev and hint is either hint's (free) left
+            // child or prev's (free) right child
+            if(hint && hint->l_child==nullptr){
+                parent = hint;
+                left = true;
             }
             else{
-                target_parent->l_child = new Node{std::move(kv)};
-                target_parent->l_child->parent = target_parent;
-                target = target_parent->l_child;
-                break;
+                parent = prev;
+                left = false;
             }
+            return nullptr;
         }
-        // >
-        else if(!cmp()(kv.first,target_parent->kv.first) &&
-                cmp()(target_parent->kv.first, kv.first)){
 
-            if(target_parent->r_child){
-                target_parent = target_parent->r_child;
+        // wrong hint (key >= hint): look around hint
+        return find_position_near(hint,key,parent,left);
+    }
+
+    // wrong hint (key <= prev): look around prev
+    return find_position_near(prev,key,parent,left);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::find_position_near(Node* finger, const K& key, Node*& parent, bool& left) const{
+    Node* from{finger};
+    if(from){
+        // key < finger: climb until an ancestor smaller than key is met coming from its right subtree
+        if(cmp()(key,from->kv.first)){
+            while(from->parent &&
+                  !(from==from->parent->r_child && cmp()(from->parent->kv.first,key))){
+                from = from->parent;
             }
-            else{
-                target_parent->r_child = new Node{std::move(kv)};
-                target_parent->r_child->parent = target_parent;
-                target = target_parent->r_child;
-                break;
+        }
+        // key > finger: climb until an ancestor greater than key is met coming from its left subtree
+        else if(cmp()(from->kv.first,key)){
+            while(from->parent &&
+                  !(from==from->parent->l_child && cmp()(key,from->parent->kv.first))){
+                from = from->parent;
             }
         }
         //=
-        else {
-            return std::make_pair(Bst::iterator{target_parent},false);
+        else{
+            return finger;
         }
-        ++new_height;
     }
-    
-    // update size and height (if necessary)
+    return find_position(key,parent,left,from);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::attach_node(Node* n, Node* parent, bool left) noexcept{
     ++size;
-    if(height<new_height){ height = new_height;}
+    n->parent = parent;
+
+    // first node
+    if(parent==nullptr){
+        root = n;
+        last_node = n;
+        return;
+    }
+
+    if(left){
+        parent->l_child = n;
+    }
+    else{
+        parent->r_child = n;
+        if(parent==last_node){ last_node = n;}
+    }
+
+    // one more node below every ancestor
+    shift_counts(parent,1);
+
+    // let the balancing policy do its job (heights are updated as well)
+    fix_after_insert(n, Balance{});
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+std::pair<typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::iterator, bool > Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::insert(Bst::kvpair&& kv){
+    hand_out();
+    Node* parent;
+    bool left;
+    Node* target{find_position(kv.first,parent,left)};
+
+    //=
+    if(target){
+        return std::make_pair(Bst::iterator{target},false);
+    }
 
+    target = create_node(std::move(kv));
+    attach_node(target,parent,left);
     return std::make_pair(Bst::iterator{target},true);
 }
 
-template< class K, class V, class cmp>
-std::pair<typename Bst< K, V, cmp>::iterator, bool > Bst<K,V,cmp>::insert(const kvpair& kv){  
-    kvpair kvcopy{kv};
-    return insert(std::move(kv));
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+std::pair<typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::iterator, bool > Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::insert(const kvpair& kv){
+    hand_out();
+    Node* parent;
+    bool left;
+    Node* target{find_position(kv.first,parent,left)};
+
+    //=
+    if(target){
+        return std::make_pair(Bst::iterator{target},false);
+    }
+
+    // kv is copied straight into the new node
+    target = create_node(kv);
+    attach_node(target,parent,left);
+    return std::make_pair(Bst::iterator{target},true);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class... vctorargtypes >
+std::pair<typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::iterator, bool > Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::emplace(const K& key, vctorargtypes&&... vctorargs){
+    hand_out();
+    Node* parent;
+    bool left;
+    Node* target{find_position(key,parent,left)};
+
+    //=
+    if(target){
+        return std::make_pair(Bst::iterator{target},false);
+    }
+
+    // braces, as emplace() always did: the value is then moved into the node
+    target = create_node(std::piecewise_construct,key,V{std::forward<vctorargtypes>(vctorargs)...});
+    attach_node(target,parent,left);
+    return std::make_pair(Bst::iterator{target},true);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class... vctorargtypes >
+std::pair<typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::iterator, bool > Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::try_emplace(const K& key, vctorargtypes&&... vctorargs){
+    hand_out();
+    Node* parent;
+    bool left;
+    Node* target{find_position(key,parent,left)};
+
+    //=
+    if(target){
+        return std::make_pair(Bst::iterator{target},false);
+    }
+
+    // the value is only built now, inside the node
+    target = create_node(std::piecewise_construct,key,std::forward<vctorargtypes>(vctorargs)...);
+    attach_node(target,parent,left);
+    return std::make_pair(Bst::iterator{target},true);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class... vctorargtypes >
+std::pair<typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::iterator, bool > Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::try_emplace(K&& key, vctorargtypes&&... vctorargs){
+    hand_out();
+    Node* parent;
+    bool left;
+    Node* target{find_position(key,parent,left)};
+
+    //=
+    if(target){
+        return std::make_pair(Bst::iterator{target},false);
+    }
+
+    target = create_node(std::piecewise_construct,std::move(key),std::forward<vctorargtypes>(vctorargs)...);
+    attach_node(target,parent,left);
+    return std::make_pair(Bst::iterator{target},true);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class M >
+std::pair<typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::iterator, bool > Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::insert_or_assign(const K& key, M&& obj){
+    hand_out();
+    Node* parent;
+    bool left;
+    Node* target{find_position(key,parent,left)};
+
+    //=
+    if(target){
+        target->kv.second = std::forward<M>(obj);
+        return std::make_pair(Bst::iterator{target},false);
+    }
+
+    target = create_node(std::piecewise_construct,key,std::forward<M>(obj));
+    attach_node(target,parent,left);
+    return std::make_pair(Bst::iterator{target},true);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class M >
+std::pair<typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::iterator, bool > Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::insert_or_assign(K&& key, M&& obj){
+    hand_out();
+    Node* parent;
+    bool left;
+    Node* target{find_position(key,parent,left)};
+
+    //=
+    if(target){
+        target->kv.second = std::forward<M>(obj);
+        return std::make_pair(Bst::iterator{target},false);
+    }
+
+    target = create_node(std::piecewise_construct,std::move(key),std::forward<M>(obj));
+    attach_node(target,parent,left);
+    return std::make_pair(Bst::iterator{target},true);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::iterator Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::insert(const_iterator hint, kvpair&& kv){
+    Node* h{hint.current};
+    hand_out(&h);
+    Node* parent;
+    bool left;
+    Node* target{find_hint_position(h,kv.first,parent,left)};
+
+    if(target==nullptr){
+        target = create_node(std::move(kv));
+        attach_node(target,parent,left);
+    }
+    return iterator{target};
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class... vctorargtypes >
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::iterator Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::emplace_hint(const_iterator hint, const K& key, vctorargtypes&&... vctorargs){
+    Node* h{hint.current};
+    hand_out(&h);
+    Node* parent;
+    bool left;
+    Node* target{find_hint_position(h,key,parent,left)};
+
+    if(target==nullptr){
+        target = create_node(std::piecewise_construct,key,V{std::forward<vctorargtypes>(vctorargs)...});
+        attach_node(target,parent,left);
+    }
+    return iterator{target};
+}
+
+
+// Bulk load
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class It >
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::build_sorted_rec(It& it, const It& last, unsigned int n, bool dedup){
+    if(n==0){
+        return nullptr;
+    }
+
+    // left half
+    unsigned int n_l{n/2};
+    Node* l{build_sorted_rec(it,last,n_l,dedup)};
+
+    // middle
+    Node* m{nullptr};
+    try{
+        m = create_node(*it);
+    }
+    catch(...){
+        if(l){ destroy_subtree(l);}
+        throw;
+    }
+    m->l_child = l;
+    if(l){ l->parent = m;}
+
+    // move past the middle (and its duplicates)
+    ++it;
+    while(dedup && it!=last && !cmp()(m->kv.first,(*it).first)){ ++it;}
+
+    // right half
+    try{
+        m->r_child = build_sorted_rec(it,last,n-1-n_l,dedup);
+    }
+    catch(...){
+        destroy_subtree(m);
+        throw;
+    }
+    if(m->r_child){ m->r_child->parent = m;}
+
+    update_height(m);
+    update_count(m);
+    return m;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class It >
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::assign(It first, It last, range_order order){
+
+    // unsorted: sort a copy, then load it as a sorted range
+    if(order==range_order::unsorted){
+        std::vector<std::pair<K,V>> buf(first,last);
+        std::stable_sort(buf.begin(),buf.end(),
+            [](const std::pair<K,V>& a, const std::pair<K,V>& b){ return cmp()(a.first,b.first);});
+        assign(std::make_move_iterator(buf.begin()),std::make_move_iterator(buf.end()),range_order::sorted);
+        return;
+    }
+
+    clear();
+    unshare();
+
+    // count the (distinct) keys
+    unsigned int n{0};
+    bool dedup{order==range_order::sorted};
+    if(dedup){
+        for(It it{first}, prev{first}; it!=last; prev=it, ++it){
+            if(it==first || cmp()((*prev).first,(*it).first)){ ++n;}
+        }
+    }
+    else{
+        n = static_cast<unsigned int>(std::distance(first,last));
+    }
+
+    alloc.reserve(n);
+    root = build_sorted_rec(first,last,n,dedup);
+    last_node = rightmost(root);
+    size = n;
+}
+
+
+// Node access
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class It, class KT>
+It Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::_find(const KT& key) const{
+    Node* target{root};
+    while(target){
+        int c{compare_keys<cmp>(key,target->kv.first)};
+        if(c==0){ break;}
+        target = c<0? target->l_child : target->r_child;
+    }
+    return It(target);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+V& Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::operator[](K&& key){
+    hand_out();
+    Node* parent;
+    bool left;
+    Node* target{find_position(key,parent,left)};
+
+    // key is only moved into a new node
+    if(target==nullptr){
+        target = create_node(std::piecewise_construct,std::move(key));
+        attach_node(target,parent,left);
+    }
+    return target->kv.second;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+V& Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::operator[](const K& key){
+    hand_out();
+    Node* parent;
+    bool left;
+    Node* target{find_position(key,parent,left)};
+
+    // key is only copied into a new node
+    if(target==nullptr){
+        target = create_node(std::piecewise_construct,key);
+        attach_node(target,parent,left);
+    }
+    return target->kv.second;
+}
+
+
+// Range queries
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class KT >
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::lower_bound_node(const KT& key) const{
+    Node *target{root}, *bound{nullptr};
+    while(target){
+        // target >= key: candidate, look for a smaller one on the left
+        if(!cmp()(target->kv.first,key)){
+            bound = target;
+            target = target->l_child;
+        }
+        else{
+            target = target->r_child;
+        }
+    }
+    return bound;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class KT >
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::upper_bound_node(const KT& key) const{
+    Node *target{root}, *bound{nullptr};
+    while(target){
+        // target > key: candidate, look for a smaller one on the left
+        if(cmp()(key,target->kv.first)){
+            bound = target;
+            target = target->l_child;
+        }
+        else{
+            target = target->r_child;
+        }
+    }
+    return bound;
 }
 
-template< class K, class V, class cmp>
-template< class... vctorargtypes >
-std::pair<typename Bst< K, V, cmp>::iterator, bool > Bst<K,V,cmp>::emplace(const K& key, vctorargtypes&&... vctorargs){
-    V value{vctorargs...};
-    kvpair kv{std::make_pair(key, std::move(value))};
-    return insert(std::move(kv));
-}  
-
 
-// Node access
+// Order statistics
 
-template< class K, class V, class cmp>
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
 template< class It>
-It Bst<K,V,cmp>::_find(const K& key) const{
+It Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::_nth(unsigned int i) const{
+    static_assert(order_stats,"Bst::nth() requires order_stats");
     Node* target{root};
     while(target){
-        bool gt{cmp()(target->kv.first,key)}, lt{cmp()(key,target->kv.first)};
-        if(gt==lt){ break;}
-        target = lt? target->l_child : target->r_child;
+        unsigned int n_l{node_count_of(target->l_child)};
+        if(i==n_l){ break;}
+        if(i<n_l){
+            target = target->l_child;
+        }
+        else{
+            // skip the left subtree and target itself
+            i -= n_l+1;
+            target = target->r_child;
+        }
     }
     return It(target);
 }
 
-template< class K, class V, class cmp>
-V& Bst<K,V,cmp>::operator[](K&& key){
-    iterator it{find(std::move(key))};
-    if(it==end()){
-        it = insert(std::move(std::make_pair(key,V()))).first;
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+unsigned int Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::rank(const K& key) const{
+    static_assert(order_stats,"Bst::rank() requires order_stats");
+    unsigned int r{0};
+    Node* target{root};
+    while(target){
+        // target < key: it precedes key together with its left subtree
+        if(cmp()(target->kv.first,key)){
+            r += node_count_of(target->l_child)+1;
+            target = target->r_child;
+        }
+        else{
+            target = target->l_child;
+        }
     }
-    return (*it).second;
-}
-
-template< class K, class V, class cmp>
-V& Bst<K,V,cmp>::operator[](const K& key){
-    auto cp{key};
-    return (*this)[std::move(cp)];
+    return r;
 }
 
 
 // Node Removal
 
 
-template< class K, class V, class cmp>
-void Bst<K,V,cmp>::erase_node(Node* n){
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::unlink_node(Node* n) noexcept{
 
-    // case 0: key not present. Skip
-    if(n==nullptr){
-        return;
+    // the greatest node has no right child: its predecessor is found quickly
+    if(n==last_node){
+        last_node = select_prev_node(n);
     }
 
     Node** parent_child{&root};
@@ -707,37 +2413,40 @@ void Bst<K,V,cmp>::erase_node(Node* n){
         // just update parent
         *parent_child = nullptr;
     }
-    // case 2: both children -> recursion and break
+    // case 2: both children -> the successor (leftmost of the right subtree,
+    //         hence with no left child) is unlinked and relinked in n's place
     else if(n->l_child!=nullptr && n->r_child!=nullptr){
-        Node* successor{select_next_node(n)};
-        
-        // substitute n->kv with successor's.
-        // UGLY BIT HERE!
-        
-        // get n links
-        Node *n_p{n->parent}, *n_l{n->l_child},*n_r{n->r_child};
-        
-        // rid of n (spare his children)
-        n->l_child = nullptr;
-        n->r_child = nullptr;
-        delete n;
-
-        // replace n and fix links in it...
-        n = new Node{successor->kv};
-        n->parent = n_p;
-        n->l_child = n_l;
-        n->r_child = n_r;
-        
-        // ... in parent ...
-        *parent_child=n;
-        
-        // ... and in children. Note that both are there beause we checked.
-        n_l->parent = n;
-        n_r->parent = n;
+        Node* successor{n->r_child};
+        while(successor->l_child){ successor = successor->l_child;}
+
+        // one node less below successor's ancestors (n among them)
+        shift_counts(successor->parent,-1);
 
-        // recursively erase successor (which is a duplicate of n, except for family)
-        erase_node(successor);
+        // lowest node whose subtree changed
+        Node* fix_from{successor};
 
+        if(successor!=n->r_child){
+            // successor's right subtree takes its place below its parent...
+            fix_from = successor->parent;
+            fix_from->l_child = successor->r_child;
+            if(successor->r_child){ successor->r_child->parent = fix_from;}
+
+            // ... while successor adopts n's right subtree
+            successor->r_child = n->r_child;
+            successor->r_child->parent = successor;
+        }
+
+        // successor adopts n's left subtree (and stats) and takes its place below n's parent
+        successor->l_child = n->l_child;
+        successor->l_child->parent = successor;
+        successor->parent = n->parent;
+        successor->height = n->height;
+        update_count(successor);
+        *parent_child = successor;
+
+        --size;
+        fix_after_erase(fix_from, Balance{});
+        link_nodes(nullptr,n,nullptr);
         return;
     }
     // case 3: one child -> link parent and child
@@ -746,67 +2455,55 @@ void Bst<K,V,cmp>::erase_node(Node* n){
             *parent_child = n->l_child;
             //else{root = n->l_child;}
             n->l_child->parent = n->parent;
-            n->l_child = nullptr;
         }
         else{
             *parent_child = n->r_child;
             n->r_child->parent = n->parent;
-            n->r_child = nullptr;
         }
     }
 
-    // either case 1 or 2, hence delete node and update tree stats
-    delete n;
+    // either case 1 or 3, hence update tree stats
+    Node* n_p{n->parent};
     --size;
-    recompute_height();
-    return;
-}
-
-template< class K, class V, class cmp>
-void Bst<K,V,cmp>::erase(const K& key){
-
-    // find node corresponding to key by traversal from root
-    Node* n{root};
-    while(n){
-
-        bool gt{cmp()(n->kv.first,key)},
-             lt{cmp()(key,n->kv.first)};
-
-        if(gt==lt){ break;}
-        
-        n = lt? n->l_child : n->r_child;
-    }
-
-    // go for the kill
-    erase_node(n);
+    shift_counts(n_p,-1);
+    fix_after_erase(n_p, Balance{});
+    link_nodes(nullptr,n,nullptr);
 }
 
-template< class K, class V, class cmp>
-void Bst<K,V,cmp>::clear(){
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::clear(){
     if(root){
 
-        // ~Node() takes care of nodes
-        delete root;
+        // Nodes still used by other copies are left to them. Otherwise, nodes need
+        // to be visited one by one only if they have something to destroy or if the
+        // allocator cannot free them all at once
+        if(!leave_share()){
+            if(!(Alloc<Node>::bulk_release && std::is_trivially_destructible<kvpair>::value)){
+                destroy_subtree(root);
+            }
+            alloc.release();
+        }
 
         // tidy up
         root = nullptr;
+        last_node = nullptr;
         size=0;
-        height=-1;
     }
+    unshareable = false;
 }
 
 
 // Output
 
-template< class K, class V, class cmp>
-std::string Bst<K,V,cmp>::kv_to_str(kvpair &kv){
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+std::string Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::kv_to_str(kvpair &kv){
     std::stringstream s;
     s<<kv.first<<":"<<kv.second;
     return s.str();   
 }
 
-template< class K, class V, class cmp>
-std::string Bst<K,V,cmp>::node_to_str(Node* n, std::string def, bool key_only){
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+std::string Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::node_to_str(Node* n, std::string def, bool key_only){
     if(n==nullptr){return def;}
 
     std::stringstream ss;
@@ -817,8 +2514,8 @@ std::string Bst<K,V,cmp>::node_to_str(Node* n, std::string def, bool key_only){
     return ss.str();
 }
 
-template< class K, class V, class cmp>
-void Bst<K,V,cmp>::populate_nodes_at_depth(Node**& first,Node* n, const int& depth){
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::populate_nodes_at_depth(Node**& first,Node* n, const int& depth){
     
     if(depth<0){return;}
 
@@ -838,8 +2535,8 @@ void Bst<K,V,cmp>::populate_nodes_at_depth(Node**& first,Node* n, const int& dep
     }
 }
 
-template< class K, class V, class cmp>
-typename Bst<K,V,cmp>::Node** Bst<K,V,cmp>::nodes_at_depth(int depth){
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node** Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::nodes_at_depth(int depth){
     
     if(depth<0){return nullptr;}
 
@@ -849,12 +2546,14 @@ typename Bst<K,V,cmp>::Node** Bst<K,V,cmp>::nodes_at_depth(int depth){
     return out;
 }
 
-template< class K, class V, class cmp>
-void Bst<K,V,cmp>::pretty_print(std::ostream &os, std::string empty){
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::pretty_print(std::ostream &os, std::string empty){
     
     // start with a newline
     std::cout<<std::endl;
 
+    int height{get_height()};
+
     // single|no node case: just print root
     if(height<1){
         os<<node_to_str(root, empty)<<std::endl;
@@ -907,53 +2606,865 @@ void Bst<K,V,cmp>::pretty_print(std::ostream &os, std::string empty){
 // Balance
 
 
-template< class K, class V, class cmp>
-void Bst<K,V,cmp>::balance_rec(kvpair**& kvs, Bst& out, int s, int f){
-    
-    // check that s<=f
-    if(f<s){
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::tree_to_vine() noexcept{
+    Node* n{root};
+    while(n){
+        // left child (if any) is rotated up, then checked again
+        if(n->l_child){
+            rotate_right(n);
+            n = n->parent;
+        }
+        else{
+            n = n->r_child;
+        }
+    }
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::compress(unsigned int count) noexcept{
+    Node* n{root};
+    for(unsigned int iii{0}; iii<count; ++iii){
+        // n goes down-left, next rotation is on the right child of its replacement
+        rotate_left(n);
+        n = n->parent->r_child;
+    }
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::recompute_heights() noexcept{
+    Node *n{root}, *prev{nullptr};
+    while(n){
+        // coming from parent: go down left, or right, if possible
+        if(prev==n->parent){
+            prev = n;
+            if(n->l_child){ n = n->l_child; continue;}
+            if(n->r_child){ n = n->r_child; continue;}
+        }
+        // coming from left child: go down right, if possible
+        else if(prev==n->l_child){
+            prev = n;
+            if(n->r_child){ n = n->r_child; continue;}
+        }
+        else{
+            prev = n;
+        }
+
+        // both children done: update and go up
+        update_height(n);
+        n = n->parent;
+    }
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::balance() noexcept(!copy_on_write){
+
+    // Exit if too small or complete
+    if(size<2 || std::log2(size+1)==get_height()+1){return;}
+    unshare();
+
+    // 1. lay nodes on a vine
+    tree_to_vine();
+
+    // 2. rotate the nodes exceeding the greatest complete tree into the bottom level
+    unsigned int full{1};
+    while(2*full+1<=size){ full = 2*full+1;}
+    compress(size-full);
+
+    // 3. repeatedly halve the vine
+    for(unsigned int m{full/2}; m>0; m/=2){
+        compress(m);
+    }
+
+    recompute_heights();
+}
+
+// Split and join
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::fix_up(Node* n, unbalanced) noexcept{
+    while(true){
+        update_height(n);
+        update_count(n);
+        if(n->parent==nullptr){ return n;}
+        n = n->parent;
+    }
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::fix_up(Node* n, avl) noexcept{
+    while(true){
+        update_height(n);
+        update_count(n);
+        int bf{node_height(n->l_child) - node_height(n->r_child)};
+
+        // left heavy
+        if(bf>1){
+            Node* l{n->l_child};
+            // left-right case: straighten first
+            if(node_height(l->l_child)<node_height(l->r_child)){
+                rotate_left_links(l);
+                update_height(l);
+            }
+            Node* top{rotate_right_links(n)};
+            update_height(n);
+            update_height(top);
+            n = top;
+        }
+        // right heavy
+        else if(bf<-1){
+            Node* r{n->r_child};
+            // right-left case: straighten first
+            if(node_height(r->r_child)<node_height(r->l_child)){
+                rotate_right_links(r);
+                update_height(r);
+            }
+            Node* top{rotate_left_links(n)};
+            update_height(n);
+            update_height(top);
+            n = top;
+        }
+
+        if(n->parent==nullptr){ return n;}
+        n = n->parent;
+    }
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::link_nodes(Node* l, Node* m, Node* r) noexcept{
+    m->parent = nullptr;
+    m->l_child = l;
+    m->r_child = r;
+    if(l){ l->parent = m;}
+    if(r){ r->parent = m;}
+    update_height(m);
+    update_count(m);
+    return m;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::replace_node(Node* x, Node* sub) noexcept{
+    Node* p{x->parent};
+    if(sub){ sub->parent = p;}
+    if(p==nullptr){
+        return sub;
+    }
+    (x==p->l_child? p->l_child : p->r_child) = sub;
+    return fix_up(p,Balance{});
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::join_nodes(Node* l, Node* m, Node* r, avl) noexcept{
+    int hl{node_height(l)}, hr{node_height(r)};
+
+    // l much taller: m goes down its right spine
+    if(hl>hr+1){
+        Node* p{l};
+        Node* c{l->r_child};
+        while(node_height(c)>hr+1){
+            p = c;
+            c = c->r_child;
+        }
+        link_nodes(c,m,r);
+        p->r_child = m;
+        m->parent = p;
+        return fix_up(p,avl{});
+    }
+
+    // r much taller: m goes down its left spine
+    if(hr>hl+1){
+        Node* p{r};
+        Node* c{r->l_child};
+        while(node_height(c)>hl+1){
+            p = c;
+            c = c->l_child;
+        }
+        link_nodes(l,m,c);
+        p->l_child = m;
+        m->parent = p;
+        return fix_up(p,avl{});
+    }
+
+    // about as tall: m on top
+    return link_nodes(l,m,r);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::join_nodes(Node* l, Node* r) noexcept{
+    if(l==nullptr){
+        return r;
+    }
+
+    // unlink the greatest node of l, its left subtree takes its place
+    Node* m{rightmost(l)};
+    Node* p{m->parent};
+    Node* c{m->l_child};
+    if(c){ c->parent = p;}
+    if(p){
+        p->r_child = c;
+        l = fix_up(p,Balance{});
+    }
+    else{
+        l = c;
+    }
+    return join_nodes(l,m,r);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class KT >
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::split_nodes(Node* n, const KT& key, Node*& l, Node*& r) noexcept{
+    l = nullptr;
+    r = nullptr;
+
+    // 1. descend to the node holding key (or to the bottom)
+    Node* m{nullptr};
+    Node* x{nullptr};
+    while(n){
+        int c{compare_keys<cmp>(key,n->kv.first)};
+        x = n;
+        if(c==0){
+            m = n;
+            break;
+        }
+        n = c<0? n->l_child : n->r_child;
+    }
+
+    // 2. its subtrees are where both parts start from
+    if(m){
+        l = m->l_child;
+        r = m->r_child;
+        if(l){ l->parent = nullptr;}
+        if(r){ r->parent = nullptr;}
+        x = m->parent;
+    }
+
+    // 3. walk back up: each node joins the part its key belongs to, with its other subtree
+    while(x){
+        Node* up{x->parent};
+        if(compare_keys<cmp>(key,x->kv.first)<0){
+            Node* xr{x->r_child};
+            if(xr){ xr->parent = nullptr;}
+            r = join_nodes(r,x,xr);
+        }
+        else{
+            Node* xl{x->l_child};
+            if(xl){ xl->parent = nullptr;}
+            l = join_nodes(xl,x,l);
+        }
+        x = up;
+    }
+
+    if(m){
+        link_nodes(nullptr,m,nullptr);
+    }
+    return m;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+unsigned int Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::split_size(Node* l, Node* r, unsigned int n_nodes, std::false_type) noexcept{
+    Node* a{leftmost(l)};
+    Node* b{leftmost(r)};
+    unsigned int c{0};
+    while(a && b){
+        a = select_next_node(a);
+        b = select_next_node(b);
+        ++c;
+    }
+    return a? n_nodes-c : c;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class FL, class FR >
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::fork_join(unsigned int threads, FL left, FR right){
+    if(threads>1){
+        std::future<void> done;
+        try{
+            done = std::async(std::launch::async,left);
+        }
+        catch(...){
+            // no thread to spare: run both here
+        }
+        if(done.valid()){
+            try{
+                right();
+            }
+            catch(...){
+                done.wait();
+                throw;
+            }
+            done.get();
+            return;
+        }
+    }
+    left();
+    right();
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::union_nodes(Node* t, Node* const* nodes, unsigned int lo, unsigned int hi, unsigned int threads, unsigned int& dropped) noexcept{
+    if(lo==hi){
+        return t;
+    }
+
+    // a single node: plain insertion (in place of its duplicate, if any)
+    if(hi-lo==1){
+        Node* m{nodes[lo]};
+        Node* p{nullptr};
+        Node* x{t};
+        int c{0};
+        while(x){
+            c = compare_keys<cmp>(m->kv.first,x->kv.first);
+            if(c==0){ break;}
+            p = x;
+            x = c<0? x->l_child : x->r_child;
+        }
+        if(x){
+            Node *xl{x->l_child}, *xr{x->r_child};
+            if(xl){ xl->parent = nullptr;}
+            if(xr){ xr->parent = nullptr;}
+            t = replace_node(x,link_nodes(xl,m,xr));
+            destroy_node(x);
+            ++dropped;
+            return t;
+        }
+        link_nodes(nullptr,m,nullptr);
+        if(p==nullptr){ return m;}
+        m->parent = p;
+        (c<0? p->l_child : p->r_child) = m;
+        return fix_up(p,Balance{});
+    }
+
+    // split t around the middle node, whose duplicate (if any) goes
+    unsigned int mid{lo+(hi-lo)/2};
+    Node* m{nodes[mid]};
+    Node *l, *r;
+    Node* dup{split_nodes(t,m->kv.first,l,r)};
+    if(dup){
+        destroy_node(dup);
+        ++dropped;
+    }
+
+    // both sides at once
+    if(hi-lo<parallel_grain){ threads = 1;}
+    unsigned int dropped_l{0}, dropped_r{0};
+    fork_join(threads,
+        [&]() noexcept{ l = union_nodes(l,nodes,lo,mid,threads/2,dropped_l);},
+        [&]() noexcept{ r = union_nodes(r,nodes,mid+1,hi,threads-threads/2,dropped_r);});
+    dropped += dropped_l+dropped_r;
+
+    return join_nodes(l,m,r);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::intersect_nodes(Node* t, const Node* const* nodes, unsigned int lo, unsigned int hi, unsigned int threads, unsigned int& dropped) noexcept{
+    if(t==nullptr){
+        return nullptr;
+    }
+    if(lo==hi){
+        dropped += count_nodes(t,count_tag{});
+        destroy_subtree(t);
+        return nullptr;
+    }
+
+    unsigned int mid{lo+(hi-lo)/2};
+    Node *l, *r;
+    Node* m{split_nodes(t,nodes[mid]->kv.first,l,r)};
+
+    if(hi-lo<parallel_grain){ threads = 1;}
+    unsigned int dropped_l{0}, dropped_r{0};
+    fork_join(threads,
+        [&]() noexcept{ l = intersect_nodes(l,nodes,lo,mid,threads/2,dropped_l);},
+        [&]() noexcept{ r = intersect_nodes(r,nodes,mid+1,hi,threads-threads/2,dropped_r);});
+    dropped += dropped_l+dropped_r;
+
+    // keys in both trees stay
+    return m? join_nodes(l,m,r) : join_nodes(l,r);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::difference_nodes(Node* t, const Node* const* nodes, unsigned int lo, unsigned int hi, unsigned int threads, unsigned int& dropped) noexcept{
+    if(t==nullptr || lo==hi){
+        return t;
+    }
+
+    // a single key: plain removal
+    if(hi-lo==1){
+        Node* x{t};
+        while(x){
+            int c{compare_keys<cmp>(nodes[lo]->kv.first,x->kv.first)};
+            if(c==0){ break;}
+            x = c<0? x->l_child : x->r_child;
+        }
+        if(x){
+            Node *xl{x->l_child}, *xr{x->r_child};
+            if(xl){ xl->parent = nullptr;}
+            if(xr){ xr->parent = nullptr;}
+            t = replace_node(x,join_nodes(xl,xr));
+            destroy_node(x);
+            ++dropped;
+        }
+        return t;
+    }
+
+    unsigned int mid{lo+(hi-lo)/2};
+    Node *l, *r;
+    Node* m{split_nodes(t,nodes[mid]->kv.first,l,r)};
+
+    if(hi-lo<parallel_grain){ threads = 1;}
+    unsigned int dropped_l{0}, dropped_r{0};
+    fork_join(threads,
+        [&]() noexcept{ l = difference_nodes(l,nodes,lo,mid,threads/2,dropped_l);},
+        [&]() noexcept{ r = difference_nodes(r,nodes,mid+1,hi,threads-threads/2,dropped_r);});
+    dropped += dropped_l+dropped_r;
+
+    // keys in both trees go
+    if(m){
+        destroy_node(m);
+        ++dropped;
+    }
+    return join_nodes(l,r);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write> Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::split(const K& key){
+    static_assert(std::is_empty<Alloc<Node>>::value,
+                  "Bst::split() needs a stateless allocation policy (e.g. heap_allocator)");
+    unshare();
+    Bst right;
+    right.unshare();
+
+    Node *l, *r;
+    Node* m{split_nodes(root,key,l,r)};
+    if(m){
+        r = join_nodes(nullptr,m,r);
+    }
+
+    unsigned int n_l{split_size(l,r,size,count_tag{})};
+    right.unshareable = unshareable;
+    right.root = r;
+    right.last_node = r? last_node : nullptr;
+    right.size = size-n_l;
+    root = l;
+    last_node = rightmost(l);
+    size = n_l;
+    return right;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write> Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::join(Bst&& left, kvpair mid, Bst&& right){
+    static_assert(std::is_empty<Alloc<Node>>::value,
+                  "Bst::join() needs a stateless allocation policy (e.g. heap_allocator)");
+    if((left.root && !cmp()(left.last_node->kv.first,mid.first)) ||
+       (right.root && !cmp()(mid.first,leftmost(right.root)->kv.first))){
+        throw std::invalid_argument("Bst::join(): keys out of order");
+    }
+    left.unshare();
+    right.unshare();
+    Bst joint;
+    joint.unshare();
+
+    Node* m{joint.create_node(std::move(mid))};
+    joint.root = join_nodes(left.root,m,right.root);
+    joint.last_node = right.root? right.last_node : m;
+    joint.size = left.size+1+right.size;
+    joint.unshareable = left.unshareable || right.unshareable;
+
+    left.unshareable = false;
+    right.unshareable = false;
+    left.root = nullptr;
+    left.last_node = nullptr;
+    left.size = 0;
+    right.root = nullptr;
+    right.last_node = nullptr;
+    right.size = 0;
+    return joint;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::merge_from(Bst&& other, unsigned int threads){
+    static_assert(std::is_empty<Alloc<Node>>::value,
+                  "Bst::merge_from() needs a stateless allocation policy (e.g. heap_allocator)");
+    if(&other==this || other.root==nullptr){
+        return;
+    }
+    unshare();
+    other.unshare();
+
+    // nodes of other, in key order
+    std::vector<Node*> nodes;
+    nodes.reserve(other.size);
+    for(Node* n{leftmost(other.root)}; n; n = select_next_node(n)){
+        nodes.push_back(n);
+    }
+    unshareable = unshareable || other.unshareable;
+    other.unshareable = false;
+    other.root = nullptr;
+    other.last_node = nullptr;
+    other.size = 0;
+
+    unsigned int dropped{0};
+    root = union_nodes(root,nodes.data(),0,static_cast<unsigned int>(nodes.size()),threads,dropped);
+    last_node = rightmost(root);
+    size += static_cast<unsigned int>(nodes.size())-dropped;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::intersect(const Bst& other, unsigned int threads){
+    if(&other==this || root==nullptr){
+        return;
+    }
+    unshare();
+
+    // nodes of other, in key order
+    std::vector<const Node*> nodes;
+    nodes.reserve(other.size);
+    for(Node* n{leftmost(other.root)}; n; n = select_next_node(n)){
+        nodes.push_back(n);
+    }
+
+    // an arena cannot take nodes back from many threads
+    if(!std::is_empty<Alloc<Node>>::value){ threads = 1;}
+    unsigned int dropped{0};
+    root = intersect_nodes(root,nodes.data(),0,static_cast<unsigned int>(nodes.size()),threads,dropped);
+    last_node = rightmost(root);
+    size -= dropped;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::difference(const Bst& other, unsigned int threads){
+    if(&other==this){
+        clear();
         return;
     }
+    if(root==nullptr || other.root==nullptr){
+        return;
+    }
+    unshare();
+
+    // nodes of other, in key order
+    std::vector<const Node*> nodes;
+    nodes.reserve(other.size);
+    for(Node* n{leftmost(other.root)}; n; n = select_next_node(n)){
+        nodes.push_back(n);
+    }
 
-    // case 1: only one element, insert it
-    if(s==f){
-        out.insert(std::move(std::make_pair( kvs[s]->first, kvs[s]->second)));
+    // an arena cannot take nodes back from many threads
+    if(!std::is_empty<Alloc<Node>>::value){ threads = 1;}
+    unsigned int dropped{0};
+    root = difference_nodes(root,nodes.data(),0,static_cast<unsigned int>(nodes.size()),threads,dropped);
+    last_node = rightmost(root);
+    size -= dropped;
+}
+
+// Parallel bulk load
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::parallel_merge(std::pair<K,V>* a, std::pair<K,V>* a_end, std::pair<K,V>* b, std::pair<K,V>* b_end, std::pair<K,V>* out, unsigned int threads){
+    std::size_t n_a{static_cast<std::size_t>(a_end-a)}, n_b{static_cast<std::size_t>(b_end-b)};
+    if(threads<2 || n_a+n_b<parallel_grain){
+        std::merge(std::make_move_iterator(a),std::make_move_iterator(a_end),
+                   std::make_move_iterator(b),std::make_move_iterator(b_end),out,pair_less);
+        return;
     }
-    // case 2: two elements insert both (s then f)
-    else if(f-s==1){
-        out.insert(std::move(std::make_pair(kvs[s]->first,kvs[s]->second)));
-        out.insert(std::move(std::make_pair(kvs[f]->first,kvs[f]->second)));
+
+    // equal keys: those of a go first (stable)
+    std::pair<K,V> *a_mid, *b_mid;
+    if(n_a>=n_b){
+        a_mid = a+n_a/2;
+        b_mid = std::lower_bound(b,b_end,*a_mid,pair_less);
     }
-    //case 3: 3+ elements. Insert middlepoint and recursively call on l and right half (mid excluded)
     else{
-        int mid{s + (f-s)/2};
-        out.insert(std::move(std::make_pair(kvs[mid]->first,kvs[mid]->second)));
-        balance_rec(kvs,out,s,mid-1);
-        balance_rec(kvs,out,mid+1,f);
+        b_mid = b+n_b/2;
+        a_mid = std::upper_bound(a,a_end,*b_mid,pair_less);
     }
+    std::pair<K,V>* out_mid{out+(a_mid-a)+(b_mid-b)};
+    fork_join(threads,
+        [=](){ parallel_merge(a,a_mid,b,b_mid,out,threads/2);},
+        [=](){ parallel_merge(a_mid,a_end,b_mid,b_end,out_mid,threads-threads/2);});
 }
 
-template< class K, class V, class cmp>
-void Bst<K,V,cmp>::balance() {
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::parallel_sort(std::pair<K,V>* first, std::pair<K,V>* tmp, std::size_t n, bool to_tmp, unsigned int threads){
+    if(threads<2 || n<parallel_grain){
+        std::stable_sort(first,first+n,pair_less);
+        if(to_tmp){ std::move(first,first+n,tmp);}
+        return;
+    }
 
-    // Exit if too small or complete
-    if(size<2 || std::log2(size+1)==height+1){return;}
+    std::size_t n_l{n/2};
+    fork_join(threads,
+        [=](){ parallel_sort(first,tmp,n_l,!to_tmp,threads/2);},
+        [=](){ parallel_sort(first+n_l,tmp+n_l,n-n_l,!to_tmp,threads-threads/2);});
 
-    // Copy ordered addressed of kv pairs in the tree
-    kvpair** kvs{new kvpair*[size]};
-    int iii{0};
-    for(auto& kv: *this){
-        kvs[iii]=&kv;
-        ++iii;
+    std::pair<K,V>* src{to_tmp? first : tmp};
+    parallel_merge(src,src+n_l,src+n_l,src+n,to_tmp? tmp : first,threads);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class F >
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::parallel_for(std::size_t lo, std::size_t hi, unsigned int threads, F f){
+    if(threads<2 || hi-lo<2){
+        for(std::size_t iii{lo};iii<hi;++iii){ f(iii);}
+        return;
+    }
+    std::size_t mid{lo+(hi-lo)/2};
+    fork_join(threads,
+        [=](){ parallel_for(lo,mid,threads/2,f);},
+        [=](){ parallel_for(mid,hi,threads-threads/2,f);});
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node* Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::build_parallel_rec(std::pair<K,V>* first, unsigned int n, unsigned int threads){
+    if(threads<2 || n<parallel_grain){
+        auto it{std::make_move_iterator(first)};
+        return build_sorted_rec(it,std::make_move_iterator(first+n),n,false);
+    }
+
+    // both halves at once
+    unsigned int n_l{n/2};
+    Node *l{nullptr}, *r{nullptr};
+    try{
+        fork_join(threads,
+            [&](){ l = build_parallel_rec(first,n_l,threads/2);},
+            [&](){ r = build_parallel_rec(first+n_l+1,n-1-n_l,threads-threads/2);});
+    }
+    catch(...){
+        if(l){ destroy_subtree(l);}
+        if(r){ destroy_subtree(r);}
+        throw;
+    }
+
+    // then the middle on top
+    Node* m{nullptr};
+    try{
+        m = create_node(std::move(first[n_l]));
+    }
+    catch(...){
+        destroy_subtree(l);
+        destroy_subtree(r);
+        throw;
+    }
+    return link_nodes(l,m,r);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class It >
+Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write> Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::build_parallel(It first, It last, unsigned int threads){
+    Bst bst;
+    bst.unshare();
+
+    std::vector<std::pair<K,V>> buf(first,last);
+    std::size_t n{buf.size()};
+    if(n==0){
+        return bst;
+    }
+    std::vector<std::pair<K,V>> tmp(n);
+
+    // 1. sort (into buf)
+    parallel_sort(buf.data(),tmp.data(),n,false,threads);
+
+    // 2. keep the first pair of each key, moving them into tmp: each chunk marks and counts
+    //    its own, then (once every key was read) moves them after those of the previous chunks
+    std::size_t n_chunks{threads>1? threads : 1};
+    std::vector<std::size_t> kept(n_chunks+1,0);
+    std::vector<char> is_first(n);
+    auto chunk_lo = [&](std::size_t c){ return c*n/n_chunks;};
+    parallel_for(0,n_chunks,threads,[&](std::size_t c){
+        for(std::size_t iii{chunk_lo(c)};iii<chunk_lo(c+1);++iii){
+            is_first[iii] = iii==0 || cmp()(buf[iii-1].first,buf[iii].first);
+            kept[c+1] += is_first[iii];
+        }
+    });
+    for(std::size_t c{0};c<n_chunks;++c){ kept[c+1] += kept[c];}
+    parallel_for(0,n_chunks,threads,[&](std::size_t c){
+        std::size_t out{kept[c]};
+        for(std::size_t iii{chunk_lo(c)};iii<chunk_lo(c+1);++iii){
+            if(is_first[iii]){ tmp[out++] = std::move(buf[iii]);}
+        }
+    });
+    unsigned int n_keys{static_cast<unsigned int>(kept[n_chunks])};
+
+    // 3. build (an arena takes nodes from one thread at a time)
+    if(!std::is_empty<Alloc<Node>>::value){ threads = 1;}
+    bst.alloc.reserve(n_keys);
+    bst.root = bst.build_parallel_rec(tmp.data(),n_keys,threads);
+    bst.last_node = rightmost(bst.root);
+    bst.size = n_keys;
+    return bst;
+}
+
+// Parallel traversals
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+std::vector<std::pair<typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::Node*,bool>> Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::cut_tree(unsigned int n_parts) const{
+    std::vector<std::pair<Node*,bool>> parts;
+    if(root){ parts.emplace_back(root,true);}
+
+    unsigned int n_whole{root? 1u : 0u};
+    for(unsigned int cuts{0}; n_whole<n_parts && cuts<4*n_parts; ++cuts){
+
+        // tallest subtree
+        std::size_t t{parts.size()};
+        for(std::size_t iii{0};iii<parts.size();++iii){
+            if(parts[iii].second && (t==parts.size() || parts[iii].first->height>parts[t].first->height)){ t = iii;}
+        }
+        if(t==parts.size() || parts[t].first->height<10){
+            break;
+        }
+
+        // its root alone, between its subtrees
+        Node* n{parts[t].first};
+        parts[t].second = false;
+        --n_whole;
+        if(n->r_child){
+            parts.insert(parts.begin()+t+1,std::make_pair(n->r_child,true));
+            ++n_whole;
+        }
+        if(n->l_child){
+            parts.insert(parts.begin()+t,std::make_pair(n->l_child,true));
+            ++n_whole;
+        }
     }
+    return parts;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class F >
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::for_part(const std::pair<Node*,bool>& part, F& f){
+    Node* n{part.first};
+    if(!part.second){
+        f(n->kv);
+        return;
+    }
+    Node* last{rightmost(n)};
+    for(n = leftmost(n); ; n = select_next_node(n)){
+        f(n->kv);
+        if(n==last){ break;}
+    }
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class F >
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::parallel_for_each(F f, unsigned int threads){
+    hand_out();
+    std::vector<std::pair<Node*,bool>> parts{cut_tree(threads>1? 4*threads : 1)};
+    parallel_for(0,parts.size(),threads,[&](std::size_t iii){
+        auto g = [&](kvpair& kv){ f(kv);};
+        for_part(parts[iii],g);
+    });
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class F >
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::parallel_for_each(F f, unsigned int threads) const{
+    std::vector<std::pair<Node*,bool>> parts{cut_tree(threads>1? 4*threads : 1)};
+    parallel_for(0,parts.size(),threads,[&](std::size_t iii){
+        auto g = [&](const kvpair& kv){ f(kv);};
+        for_part(parts[iii],g);
+    });
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+template< class T, class Op, class Proj >
+T Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::parallel_reduce(T init, Op op, Proj proj, unsigned int threads) const{
+    std::vector<std::pair<Node*,bool>> parts{cut_tree(threads>1? 4*threads : 1)};
+
+    // fold each part on its own (parts are never empty)...
+    std::vector<std::unique_ptr<T>> partial(parts.size());
+    parallel_for(0,parts.size(),threads,[&](std::size_t iii){
+        std::unique_ptr<T> acc;
+        auto fold = [&](const kvpair& kv){
+            if(acc){ *acc = op(std::move(*acc),T(proj(kv)));}
+            else{ acc.reset(new T(proj(kv)));}
+        };
+        for_part(parts[iii],fold);
+        partial[iii] = std::move(acc);
+    });
+
+    // ...then fold the parts, in key order
+    for(auto& p: partial){
+        init = op(std::move(init),std::move(*p));
+    }
+    return init;
+}
+
+// Node handles
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::node_type Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::extract(const_iterator pos){
+    static_assert(std::is_empty<Alloc<Node>>::value,
+                  "Bst node handles need a stateless allocation policy (e.g. heap_allocator)");
+    Node* n{pos.current};
+    unshare(&n);
+    unlink_node(n);
+    return node_type{n};
+}
 
-    // build balanced copy recursively
-    Bst balanced;
-    balance_rec(kvs,balanced,0,size-1);
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::insert_return_type Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::insert(node_type&& nh){
+    static_assert(std::is_empty<Alloc<Node>>::value,
+                  "Bst node handles need a stateless allocation policy (e.g. heap_allocator)");
+    hand_out();
+    if(nh.empty()){
+        return insert_return_type{end(),false,node_type{}};
+    }
+
+    Node* parent;
+    bool left;
+    Node* target{find_position(nh.key(),parent,left)};
+    if(target){
+        return insert_return_type{iterator{target},false,std::move(nh)};
+    }
+
+    target = nh.n;
+    nh.n = nullptr;
+    attach_node(target,parent,left);
+    return insert_return_type{iterator{target},true,node_type{}};
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+typename Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::iterator Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::insert(const_iterator hint, node_type&& nh){
+    static_assert(std::is_empty<Alloc<Node>>::value,
+                  "Bst node handles need a stateless allocation policy (e.g. heap_allocator)");
+    Node* h{hint.current};
+    hand_out(&h);
+    if(nh.empty()){
+        return end();
+    }
+
+    Node* parent;
+    bool left;
+    Node* target{find_hint_position(h,nh.key(),parent,left)};
+    if(target==nullptr){
+        target = nh.n;
+        nh.n = nullptr;
+        attach_node(target,parent,left);
+    }
+    return iterator{target};
+}
 
-    // free resources
-    delete[] kvs;
+template< class K, class V, class cmp, template<class> class Alloc, class Balance, bool order_stats, bool copy_on_write>
+void Bst<K,V,cmp,Alloc,Balance,order_stats,copy_on_write>::merge(Bst& src){
+    static_assert(std::is_empty<Alloc<Node>>::value,
+                  "Bst::merge() needs a stateless allocation policy (e.g. heap_allocator)");
+    if(&src==this || src.root==nullptr){
+        return;
+    }
+    unshare();
+    src.unshare();
+    // handles into src may now point into this tree
+    unshareable = unshareable || src.unshareable;
 
-    // substitutes *this with balanced tree
-    *this = std::move(balanced);
-}
\ No newline at end of file
+    // unlinking a node keeps the order of the others: the next one stays the next one
+    Node* n{leftmost(src.root)};
+    while(n){
+        Node* next{select_next_node(n)};
+        Node* parent;
+        bool left;
+        if(find_position(n->kv.first,parent,left)==nullptr){
+            src.unlink_node(n);
+            attach_node(n,parent,left);
+        }
+        n = next;
+    }
+}
@@ -1,12 +1,32 @@
 #pragma once
 
 #include "bst.hpp"
+#include "compact_bst.hpp"
+#include "btree.hpp"
+#include "concurrent_bst.hpp"
+#include "lockfree_bst.hpp"
+#include "sharded_bst.hpp"
+#include "persistent_bst.hpp"
 #include <iostream>
 #include <iomanip>
 #include <chrono>
 #include <algorithm>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <set>
 
 typedef Bst<int,double> Testbst;
+typedef Bst<int,double,std::less<int>,arena_allocator> Arenabst;
+typedef Bst<int,double,std::less<int>,heap_allocator,avl> Avlbst;
+typedef Bst<int,double,std::less<int>,heap_allocator,avl,true> Rankedbst;
+typedef Bst<int,double,std::less<int>,heap_allocator,unbalanced,false,true> Cowbst;
+typedef CompactBst<int,double> Compactbst;
+typedef BTree<int,double> Btree;
 
 
 int* get_random_arr(unsigned int size){
@@ -17,6 +37,52 @@ int* get_random_arr(unsigned int size){
     std::random_shuffle(a,&a[size]);
     return a;
 }
+
+/// @brief Returns the keys 1...size in nearly sorted order: each key is at most
+///        window-1 positions away from its sorted place.
+/// 
+/// @param size     number of keys
+/// @param window   size of the blocks that get shuffled
+/// @return int*    array of keys (to be deleted[] by the caller)
+int* get_nearly_sorted_arr(unsigned int size, unsigned int window){
+    int* a{new int[size]};
+    for(int iii{0};iii<(int)size;++iii){
+        a[iii]=iii+1;
+    }
+    for(unsigned int first{0};first<size;first+=window){
+        std::random_shuffle(&a[first],&a[std::min(first+window,size)]);
+    }
+    return a;
+}
+
+/// @brief Fills a bst with keys 1...N laid out as in the performance tests.
+/// 
+/// @tparam Tree    bst type
+/// @param bst      (empty) tree to fill
+/// @param N        number of keys
+/// @param layout   "1->N", "N->1" or "rnd"
+/// @param keys     shuffled keys 1...N (only used by "rnd")
+template<class Tree>
+void fill_test_tree(Tree& bst, int N, const std::string& layout, const int* keys){
+    if(layout=="1->N"){
+        for(int iii{1};iii<=N;++iii){
+            bst.emplace(iii,(double)iii);
+        }
+    }
+    else if(layout=="N->1"){
+        for(int iii{N};iii>=1;--iii){
+            bst.emplace(iii,(double)iii);
+        }
+    }
+    else{
+        for(int iii{0};iii<N;++iii){
+            bst.emplace(keys[iii],(double)(keys[iii]));
+        }
+    }
+}
+
+/// @brief Layouts used by fill_test_tree()
+const char* test_layouts[]{"1->N","N->1","rnd"};
 /// @brief Runs an interactive sandbox test that features a simple command prompt to play with the BST.
 /// 
 void test_interactive(){
@@ -145,8 +211,144 @@ void test_interactive(){
     std::cout<<"Thanks for running the demo :)\nBye bye!"<<std::endl;
 }
 
+/// @brief Hammers a LockFreeBst from many threads and checks every answer it gives.
+///        Each worker owns the keys equal to its id modulo n_threads: it inserts and erases
+///        them at random, knowing exactly which ones are present, and checks the results of
+///        insert, erase, find and contains on them (and looks up other keys meanwhile).
+///        One more thread keeps iterating, checking that keys come in increasing order.
+///        In the end, the tree must hold exactly the keys the workers think it does.
+///
+/// @param n_threads    Number of worker threads
+/// @param ops          Operations per worker
+/// @param range        Keys are taken from 0...range-1 (small ranges mean more contention)
+/// @return bool        Whether every check passed
+bool test_lockfree_stress(int n_threads=8, int ops=1<<16, int range=1<<10){
+    std::cout<<"Lock-free stress test ("<<n_threads<<" threads, "<<ops<<" ops each, keys < "<<range<<")"<<std::endl;
+
+    LockFreeBst<int,int> lf;
+    std::vector<std::set<int>> owned(n_threads);
+    std::atomic<int> errors{0};
+    std::atomic<bool> done{false};
+
+    auto worker = [&](int id){
+        std::mt19937 gen(id);
+        std::set<int>& mine{owned[id]};
+        for(int iii{0};iii<ops;++iii){
+            int key{int(gen()%(range/n_threads))*n_threads+id};
+            bool present{mine.count(key)>0};
+            int value{-1};
+            switch(gen()%3){
+                case 0:
+                    if(lf.emplace(key,key)==present){ ++errors;}
+                    mine.insert(key);
+                    break;
+                case 1:
+                    if(lf.erase(key)!=present){ ++errors;}
+                    mine.erase(key);
+                    break;
+                default:
+                    if(lf.find(key,value)!=present || (present && value!=key)){ ++errors;}
+                    if(lf.contains(key)!=present){ ++errors;}
+            }
+            // someone else's key: any answer will do, but it must be consistent
+            key = int(gen()%range);
+            if(lf.find(key,value) && value!=key){ ++errors;}
+        }
+    };
+
+    auto scanner = [&](){
+        while(!done){
+            int prev{-1};
+            for(auto it{lf.cbegin()};it!=lf.cend();++it){
+                if((*it).first<=prev || (*it).second!=(*it).first){ ++errors;}
+                prev = (*it).first;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(int iii{0};iii<n_threads;++iii){ threads.emplace_back(worker,iii);}
+    std::thread scan{scanner};
+    for(auto& t: threads){ t.join();}
+    done = true;
+    scan.join();
+
+    std::set<int> expected;
+    for(auto& mine: owned){ expected.insert(mine.begin(),mine.end());}
+    auto ex{expected.begin()};
+    for(auto it{lf.cbegin()};it!=lf.cend();++it,++ex){
+        if(ex==expected.end() || (*it).first!=*ex){
+            ++errors;
+            break;
+        }
+    }
+    if(ex!=expected.end() || lf.get_size()!=expected.size()){ ++errors;}
+
+    std::cout<<(errors? "FAILED: " : "OK: ")<<errors<<" wrong answers, "<<expected.size()<<" keys left"<<std::endl;
+    return errors==0;
+}
+
 #define BEST_D_0 2e100
 
+/// @brief Checks that copy-on-write trees do not leak writes into their copies through
+///        references and iterators handed out before the copy (operator[], non-const find(),
+///        begin()...), by copy ctor and by copy assignment, also when the tree changed between
+///        handing out and copying, and that copies taken after a clear() share nodes again
+///        without seeing later writes.
+///
+/// @param N        Number of keys in the tree
+/// @return bool    Whether every check passed
+bool test_cow_handles(int N=1<<10){
+    std::cout<<"Copy-on-write handles test ("<<N<<" keys)"<<std::endl;
+
+    int errors{0};
+    Cowbst a;
+    for(int iii{0};iii<N;++iii){ a.emplace(iii,(double)iii);}
+
+    // value at key in a copy, read without unsharing it
+    auto value_at = [](const Cowbst& bst, int key){ return (*bst.find(key)).second;};
+
+    // a reference taken before a copy ctor
+    double& r{a[1]};
+    Cowbst b{a};
+    r = -1;
+    if(value_at(b,1)!=1 || value_at(a,1)!=-1){ ++errors;}
+
+    // a non-const iterator taken before a copy assignment
+    auto it{a.find(2)};
+    Cowbst c;
+    c = a;
+    (*it).second = -2;
+    if(value_at(c,2)!=2 || value_at(a,2)!=-2){ ++errors;}
+
+    // begin() hands out iterators too
+    auto first{a.begin()};
+    Cowbst d{a};
+    (*first).second = -3;
+    if(value_at(d,0)!=0){ ++errors;}
+
+    // iterators survive changes to other keys: copies stay deep after them
+    auto third{a.find(3)};
+    a.erase(N-1);
+    Cowbst e{a};
+    (*third).second = -4;
+    if(value_at(e,3)!=3){ ++errors;}
+
+    // after a clear() no handle is left: a bulk loaded tree shares again,
+    // and writes on either side stay there
+    std::vector<std::pair<int,double>> kvs;
+    for(int iii{0};iii<N;++iii){ kvs.emplace_back(iii,(double)iii);}
+    a.clear();
+    a.assign(kvs.begin(),kvs.end(),range_order::sorted_unique);
+    Cowbst f{a};
+    f[5] = -5;
+    a[6] = -6;
+    if(value_at(a,5)!=5 || value_at(f,6)!=6 || f.get_size()!=a.get_size()){ ++errors;}
+
+    std::cout<<(errors? "FAILED: " : "OK: ")<<errors<<" leaked writes"<<std::endl;
+    return errors==0;
+}
+
 /// @brief  Runs a series of repeated tests and prints the timing results on std::out.
 ///         Each test is performed on three different BSTs:
 ///         - 1->N      Obtained by inserting numbers from 1 to N sequentially (a huge right arm)
@@ -165,6 +367,59 @@ void test_interactive(){
 ///         7. Clear            BST is cleared
 ///         8. Arbitrary erase  All nodes are removed in a random order (same for all trees at each routine)
 ///
+///         Copy is also timed for PersistentBst::snapshot(), which shares every node (rows tagged "snapshot"),
+///         and for copy-on-write trees: filled by emplace(), whose iterators keep the tree from sharing, the copy
+///         is deep (rows tagged "cow"); bulk loaded, the copy shares every node (rows tagged "bulk cow").
+///         Build, Copy, Clear and Arbitrary erase are also repeated with nodes allocated
+///         from an arena (rows tagged "arena") to compare against the default heap allocator.
+///         Build, Arbitrary access and Arbitrary erase are also repeated on self-balancing trees (rows tagged "avl").
+///         Build is also timed for the bulk-load ctor, on sorted and shuffled input (rows tagged "bulk").
+///         Build, Arbitrary access and Arbitrary erase are also repeated on the index-based
+///         CompactBst (rows tagged "compact").
+///         Build, Traversal, Arbitrary access and Arbitrary erase are also repeated on the
+///         B+-tree BTree (rows tagged "btree").
+///         Since heights are kept up to date incrementally, erase costs O(h): the "rnd" and "avl" rows
+///         of Arbitrary erase grow (almost) linearly with N, only degenerate trees stay quadratic.
+///
+///         9. Hinted build     avl BST is filled with sorted and nearly sorted keys (blocks of 8 shuffled),
+///                             by plain emplace() and by emplace_hint() with end() as hint; repeated on
+///                             unbalanced BST (rows tagged "unbal"), where both grow a vine and stay quadratic
+///         10. Order statistics avl BST with subtree sizes (random keys) is asked for the 100 percentiles,
+///                             by walking an iterator ("walk"), by nth() and, backwards, by rank()
+///         11. Range scan      avl BST (random keys) sums the values of 100 windows of 16 keys,
+///                             skipping from begin() ("skip") or through range() ("range")
+///         12. Frozen lookup   BST (random keys) and its frozen snapshot (Bst::freeze()) are probed for
+///                             every key, in random ("rnd") and increasing ("seq") order,
+///                             with Bst::find() ("find") and FrozenBst::find() ("frozen")
+///         13. Comparisons     BST with string keys (random, long common prefix) is probed for every key,
+///                             comparing keys with std::less both ways ("2way") or with a single
+///                             three-way compare per level ("3way"); the comparisons made per find
+///                             are counted (counting_compare) and shown next to the tree tag
+///         14. Emplace         avl BST with vector<double>(16) values is fed the random keys 1...N, either new
+///                             ("new") or all already present ("hit"), through insert(make_pair(...))
+///                             ("insert") or try_emplace() ("try_emplace")
+///         15. Concurrent reads Reader threads (1 to 32) look up random keys in an avl BST of the largest size
+///                             tested, while one writer thread erases and reinserts keys: 0%, 1% or 10%
+///                             as many writes as reads. The tree is either guarded by a single mutex
+///                             ("mutex") or wrapped in ConcurrentBst ("seqlock"). Reported in reads/s.
+///         16. Lock-free       Worker threads (1 to 32) run a mix of finds, inserts and erases (10% or 50%
+///                             writes) on random keys, half of them present, in a tree of the largest size
+///                             tested: an avl BST guarded by a single mutex ("mutex") or a LockFreeBst
+///                             ("lockfree"). Reported in operations/s.
+///         17. Sharded insert  Worker threads (1 to 32) insert the random keys 1...N of the largest size tested
+///                             into a tree already holding 1/16 of them: an avl BST guarded by a single mutex
+///                             ("mutex") or a ShardedBst with 64 range shards, balanced after the first
+///                             keys ("sharded"). Reported in inserts/s.
+///         18. Set operations  avl BST (random keys 1...N) is merged with, intersected with or stripped of the
+///                             keys of another one holding N/16 random keys 1...2N, element by element
+///                             through operator[], find() and erase() ("loop") or through the join-based
+///                             merge_from(), intersect() and difference() ("join")
+///         19. Parallel build  avl BST is built from the random keys 1...N of the largest size tested, by the
+///                             single threaded bulk-load ctor ("bulk") and by build_parallel() with 1 to 32
+///                             threads ("parallel")
+///         20. Parallel reduce avl BST (random keys 1...N of the largest size tested) sums its values, walking an
+///                             iterator ("iterator") or by parallel_reduce() with 1 to 32 threads ("reduce")
+///
 /// @param trials   Number of trials that each test will be repeated to compute averge score.
 /// @param baseN    Starting size of the tested BSTs. Following routines duplicate it (e.g. 2->4->8...)
 /// @param maxN     Maximum size (<=) of the tested bst.
@@ -187,6 +442,62 @@ void test_performance(int trials=5, int baseN=1<<4, int maxN=(1<<15)){
         acc+=trial_secs.count();
     };
 
+    auto print_header = [&](const std::string& title){
+        std::cout<<title<<std::endl;
+        std::cout<< std::left
+                 <<std::setw(16)<<"N"
+                 <<std::setw(16)<<"Tree"
+                 <<std::setw(16)<<"AVG"
+                 <<std::setw(16)<<"worst"
+                 <<std::setw(16)<<"best"
+                 <<std::endl;
+    };
+
+    auto print_row = [&](const std::string& n_col, const std::string& tree){
+        avg=acc/trials;
+        std::cout<<std::setw(16)<<n_col
+                 <<std::setw(16)<<tree
+                 <<std::setw(16)<<avg
+                 <<std::setw(16)<<worst
+                 <<std::setw(16)<<best
+                 <<std::endl;
+    };
+
+    // Times body(bst) on a tree of the type of empty_tree filled with N keys (1->N, N->1, rnd),
+    // trials times per layout, and prints a row tagged "<layout> <tag>" for each layout.
+    // If fill_timed the fill itself is timed too (with body just_fill: only the fill is).
+    // Whatever body returns (e.g. a copy) is only destroyed once the clock is stopped.
+    auto time_layouts = [&](auto empty_tree, int N, const std::string& tag, auto body, bool fill_timed=false){
+        for(auto layout: test_layouts){
+            new_routine();
+            for(int ttt{0};ttt<trials;++ttt){
+
+                decltype(empty_tree) bst;
+                int* a{get_random_arr(N)};
+                if(!fill_timed){ fill_test_tree(bst,N,layout,a);}
+
+                start = std::chrono::steady_clock::now();
+                if(fill_timed){ fill_test_tree(bst,N,layout,a);}
+                auto out{body(bst)};
+                end = std::chrono::steady_clock::now();
+                (void)out;
+
+                delete[] a;
+                finalize_trial();
+            }
+            print_row("\"",std::string(layout)+" "+tag);
+        }
+    };
+
+    // bodies shared by several tests
+    auto just_fill = [](auto&){ return 0;};
+    auto copy_of = [](auto& bst){ return std::decay_t<decltype(bst)>(bst);};
+    auto walk = [](auto& bst){
+        auto it{bst.begin()};
+        while(it!=bst.end()){++it;}
+        return 0;
+    };
+
     // save cout flags to restore them later
     std::ios_base::fmtflags defflags( std::cout.flags() );
     std::cout<<std::setprecision(15);
@@ -270,6 +581,41 @@ void test_performance(int trials=5, int baseN=1<<4, int maxN=(1<<15)){
                  <<std::setw(16)<<worst
                  <<std::setw(16)<<best
                  <<std::endl;
+
+        //arena
+        time_layouts(Arenabst{},N,"arena",just_fill,true);
+
+        //avl
+        time_layouts(Avlbst{},N,"avl",just_fill,true);
+
+        //compact
+        time_layouts(Compactbst{},N,"compact",just_fill,true);
+
+        //btree
+        time_layouts(Btree{},N,"btree",just_fill,true);
+
+        //bulk load (sorted, then shuffled input)
+        for(auto layout: {"1->N","rnd"}){
+            new_routine();
+            for(int ttt{0};ttt<trials;++ttt){
+
+                int* a{get_random_arr(N)};
+                std::vector<std::pair<int,double>> kvs;
+                kvs.reserve(N);
+                for(int iii{0};iii<N;++iii){
+                    int k{std::string(layout)=="rnd"? a[iii] : iii+1};
+                    kvs.emplace_back(k,(double)k);
+                }
+                auto order{std::string(layout)=="rnd"? range_order::unsorted : range_order::sorted_unique};
+
+                start = std::chrono::steady_clock::now();
+                Testbst bst(kvs.begin(),kvs.end(),order);
+                end = std::chrono::steady_clock::now();
+                delete[] a;
+                finalize_trial();
+            }
+            print_row("\"",std::string(layout)+" bulk");
+        }
     }
  
     //--------------------------------
@@ -355,6 +701,40 @@ void test_performance(int trials=5, int baseN=1<<4, int maxN=(1<<15)){
                  <<std::setw(16)<<worst
                  <<std::setw(16)<<best
                  <<std::endl;
+
+        //arena (copies are carved out of a single block)
+        time_layouts(Arenabst{},N,"arena",copy_of);
+
+        //persistent (the snapshot shares every node)
+        time_layouts(PersistentBst<int,double>{},N,"snapshot",[](auto& bst){ return bst.snapshot();});
+
+        //copy-on-write, filled by emplace(): the iterators it handed out force a deep copy
+        time_layouts(Cowbst{},N,"cow",copy_of);
+
+        //copy-on-write, bulk loaded: no handle was given out, the copy shares every node
+        for(auto layout: {"1->N","rnd"}){
+            new_routine();
+            for(int ttt{0};ttt<trials;++ttt){
+
+                int* a{get_random_arr(N)};
+                std::vector<std::pair<int,double>> kvs;
+                kvs.reserve(N);
+                for(int iii{0};iii<N;++iii){
+                    int k{std::string(layout)=="rnd"? a[iii] : iii+1};
+                    kvs.emplace_back(k,(double)k);
+                }
+                auto order{std::string(layout)=="rnd"? range_order::unsorted : range_order::sorted_unique};
+                Cowbst bst(kvs.begin(),kvs.end(),order);
+
+                start = std::chrono::steady_clock::now();
+                auto cp{bst};
+                end = std::chrono::steady_clock::now();
+
+                delete[] a;
+                finalize_trial();
+            }
+            print_row("\"",std::string(layout)+" bulk cow");
+        }
     }
     
     //--------------------------------
@@ -617,6 +997,9 @@ void test_performance(int trials=5, int baseN=1<<4, int maxN=(1<<15)){
                  <<std::setw(16)<<worst
                  <<std::setw(16)<<best
                  <<std::endl;
+
+        //btree (leaves are linked: the scan is sequential)
+        time_layouts(Btree{},N,"btree",walk);
     }
 
     
@@ -710,6 +1093,22 @@ void test_performance(int trials=5, int baseN=1<<4, int maxN=(1<<15)){
                  <<std::setw(16)<<worst
                  <<std::setw(16)<<best
                  <<std::endl;
+
+        auto access = [N](auto& bst){
+            for(int iii{1};iii<=N;++iii){
+                bst[iii];
+            }
+            return 0;
+        };
+
+        //avl
+        time_layouts(Avlbst{},N,"avl",access);
+
+        //compact
+        time_layouts(Compactbst{},N,"compact",access);
+
+        //btree
+        time_layouts(Btree{},N,"btree",access);
     }
 
     
@@ -797,6 +1196,9 @@ void test_performance(int trials=5, int baseN=1<<4, int maxN=(1<<15)){
                  <<std::setw(16)<<worst
                  <<std::setw(16)<<best
                  <<std::endl;
+
+        //arena
+        time_layouts(Arenabst{},N,"arena",[](auto& bst){ bst.clear(); return 0;});
     }
     
     
@@ -892,11 +1294,685 @@ void test_performance(int trials=5, int baseN=1<<4, int maxN=(1<<15)){
                  <<std::setw(16)<<best
                  <<std::endl;
 
+        auto erase_all = [N,erase_ord](auto& bst){
+            for(int iii{0};iii<N;++iii){
+                bst.erase(erase_ord[iii]);
+            }
+            return 0;
+        };
+
+        //arena
+        time_layouts(Arenabst{},N,"arena",erase_all);
+
+        //avl
+        time_layouts(Avlbst{},N,"avl",erase_all);
+
+        //compact
+        time_layouts(Compactbst{},N,"compact",erase_all);
+
+        //btree
+        time_layouts(Btree{},N,"btree",erase_all);
+
 
         delete[] erase_ord;
     }
 
 
+    //--------------------------------
+    // Hinted build test
+    //--------------------------------
+    print_header("Hinted build test");
+    for(int N{baseN};N<maxN;N=(N<<1)){
+        bool first_row{true};
+
+        // empty_tree only selects the tree type
+        auto hinted_build = [&](auto empty_tree, const std::string& tree){
+            for(auto layout: {"sorted","near"}){
+                for(bool hinted: {false,true}){
+                    new_routine();
+                    for(int ttt{0};ttt<trials;++ttt){
+
+                        decltype(empty_tree) bst;
+                        int* a{std::string(layout)=="sorted"? get_nearly_sorted_arr(N,1) : get_nearly_sorted_arr(N,8)};
+
+                        start = std::chrono::steady_clock::now();
+                        if(hinted){
+                            for(int iii{0};iii<N;++iii){
+                                bst.emplace_hint(bst.cend(),a[iii],(double)(a[iii]));
+                            }
+                        }
+                        else{
+                            for(int iii{0};iii<N;++iii){
+                                bst.emplace(a[iii],(double)(a[iii]));
+                            }
+                        }
+                        end = std::chrono::steady_clock::now();
+
+                        delete[] a;
+                        finalize_trial();
+                    }
+                    print_row(first_row? std::to_string(N) : "\"", std::string(layout)+(hinted?" hint":"")+tree);
+                    first_row = false;
+                }
+            }
+        };
+        hinted_build(Avlbst{},"");
+        hinted_build(Testbst{}," unbal");
+    }
+
+
+    //--------------------------------
+    // Order statistics test
+    //--------------------------------
+    print_header("Order statistics test");
+    for(int N{baseN};N<maxN;N=(N<<1)){
+        bool first_row{true};
+        for(auto method: {"walk","nth","rank"}){
+            new_routine();
+            for(int ttt{0};ttt<trials;++ttt){
+
+                Rankedbst bst;
+                int* a{get_random_arr(N)};
+                fill_test_tree(bst,N,"rnd",a);
+
+                // keep the results alive
+                long checksum{0};
+
+                start = std::chrono::steady_clock::now();
+                for(int pct{0};pct<100;++pct){
+                    unsigned int i{(unsigned int)((long)N*pct/100)};
+                    if(std::string(method)=="walk"){
+                        auto it{bst.begin()};
+                        for(unsigned int jjj{0};jjj<i;++jjj){ ++it;}
+                        checksum += (*it).first;
+                    }
+                    else if(std::string(method)=="nth"){
+                        checksum += (*bst.nth(i)).first;
+                    }
+                    else{
+                        checksum += bst.rank((int)i+1);
+                    }
+                }
+                end = std::chrono::steady_clock::now();
+
+                if(checksum<0){ std::cout<<checksum;}
+                delete[] a;
+                finalize_trial();
+            }
+            print_row(first_row? std::to_string(N) : "\"", method);
+            first_row = false;
+        }
+    }
+
+
+    //--------------------------------
+    // Range scan test
+    //--------------------------------
+    print_header("Range scan test");
+    for(int N{baseN};N<maxN;N=(N<<1)){
+        bool first_row{true};
+        for(bool ranged: {false,true}){
+            new_routine();
+            for(int ttt{0};ttt<trials;++ttt){
+
+                Avlbst bst;
+                int* a{get_random_arr(N)};
+                fill_test_tree(bst,N,"rnd",a);
+
+                // keep the results alive
+                double sum{0};
+
+                start = std::chrono::steady_clock::now();
+                for(int win{0};win<100;++win){
+                    int lo{a[win%N]}, hi{lo+16};
+                    if(ranged){
+                        for(auto& kv: bst.range(lo,hi)){ sum += kv.second;}
+                    }
+                    else{
+                        auto it{bst.begin()};
+                        while(it!=bst.end() && (*it).first<lo){ ++it;}
+                        for(; it!=bst.end() && (*it).first<hi; ++it){ sum += (*it).second;}
+                    }
+                }
+                end = std::chrono::steady_clock::now();
+
+                if(sum<0){ std::cout<<sum;}
+                delete[] a;
+                finalize_trial();
+            }
+            print_row(first_row? std::to_string(N) : "\"", ranged? "range" : "skip");
+            first_row = false;
+        }
+    }
+
+
+    //--------------------------------
+    // Frozen lookup test
+    //--------------------------------
+    print_header("Frozen lookup test");
+    for(int N{baseN};N<maxN;N=(N<<1)){
+        bool first_row{true};
+        for(auto probes: {"rnd","seq"}){
+            for(bool frozen: {false,true}){
+                new_routine();
+                for(int ttt{0};ttt<trials;++ttt){
+
+                    Testbst bst;
+                    int* a{get_random_arr(N)};
+                    fill_test_tree(bst,N,"rnd",a);
+                    auto snapshot{bst.freeze()};
+
+                    // random probes reuse the (shuffled) insertion order
+                    int* p{std::string(probes)=="rnd"? a : get_nearly_sorted_arr(N,1)};
+
+                    // keep the results alive
+                    double sum{0};
+
+                    start = std::chrono::steady_clock::now();
+                    if(frozen){
+                        for(int iii{0};iii<N;++iii){ sum += (*snapshot.find(p[iii])).second;}
+                    }
+                    else{
+                        for(int iii{0};iii<N;++iii){ sum += (*bst.find(p[iii])).second;}
+                    }
+                    end = std::chrono::steady_clock::now();
+
+                    if(sum<0){ std::cout<<sum;}
+                    if(p!=a){ delete[] p;}
+                    delete[] a;
+                    finalize_trial();
+                }
+                print_row(first_row? std::to_string(N) : "\"", std::string(probes)+(frozen?" frozen":" find"));
+                first_row = false;
+            }
+        }
+    }
+
+
+    //--------------------------------
+    // Comparisons test
+    //--------------------------------
+    print_header("Comparisons test");
+    for(int N{baseN};N<maxN;N=(N<<1)){
+
+        // zero-padded numbers: keys share long prefixes, as paths or ids do
+        int* a{get_random_arr(N)};
+        std::vector<std::string> keys;
+        for(int iii{0};iii<N;++iii){
+            std::string digits{std::to_string(a[iii])};
+            keys.push_back("key/"+std::string(12-digits.size(),'0')+digits);
+        }
+        delete[] a;
+
+        // times a find() of every key, then prints the comparisons made per find
+        auto probe = [&](auto& bst, unsigned long long& calls, const std::string& n_col, const std::string& tree){
+            for(const auto& k: keys){ bst.emplace(k,1.0);}
+
+            new_routine();
+            unsigned long long calls_before{calls};
+            double sum{0};
+            for(int ttt{0};ttt<trials;++ttt){
+                start = std::chrono::steady_clock::now();
+                for(const auto& k: keys){ sum += (*bst.find(k)).second;}
+                end = std::chrono::steady_clock::now();
+                finalize_trial();
+            }
+            if(sum<0){ std::cout<<sum;}
+
+            std::ostringstream tag;
+            tag<<tree<<" "<<std::setprecision(3)<<double(calls-calls_before)/(double(trials)*N)<<"/find";
+            print_row(n_col,tag.str());
+        };
+
+        typedef counting_compare<std::less<std::string>,false> two_way_cmp;
+        typedef counting_compare<std::less<std::string>,true> three_way_cmp;
+        Bst<std::string,double,two_way_cmp> two_way;
+        Bst<std::string,double,three_way_cmp> three_way;
+        probe(two_way,two_way_cmp::calls(),std::to_string(N),"2way");
+        probe(three_way,three_way_cmp::calls(),"\"","3way");
+    }
+
+
+    //--------------------------------
+    // Emplace test
+    //--------------------------------
+    // values expensive to build: insert(make_pair(...)) builds (and moves) one
+    // for every call, try_emplace() only when the key is new
+    print_header("Emplace test");
+    for(int N{baseN};N<maxN;N=(N<<1)){
+        typedef Bst<int,std::vector<double>,std::less<int>,heap_allocator,avl> Vecbst;
+        bool first_row{true};
+        for(bool hit: {false,true}){
+            for(bool in_place: {false,true}){
+                new_routine();
+                for(int ttt{0};ttt<trials;++ttt){
+
+                    int* a{get_random_arr(N)};
+                    Vecbst bst;
+                    if(hit){
+                        for(int iii{0};iii<N;++iii){ bst.try_emplace(a[iii],16,1.0);}
+                    }
+
+                    start = std::chrono::steady_clock::now();
+                    if(in_place){
+                        for(int iii{0};iii<N;++iii){ bst.try_emplace(a[iii],16,(double)a[iii]);}
+                    }
+                    else{
+                        for(int iii{0};iii<N;++iii){ bst.insert(std::make_pair(a[iii],std::vector<double>(16,(double)a[iii])));}
+                    }
+                    end = std::chrono::steady_clock::now();
+
+                    delete[] a;
+                    finalize_trial();
+                }
+                print_row(first_row? std::to_string(N) : "\"", std::string(hit?"hit":"new")+(in_place?" try_emplace":" insert"));
+                first_row = false;
+            }
+        }
+    }
+
+
+    //--------------------------------
+    // Concurrent reads test
+    //--------------------------------
+    std::cout<<"Concurrent reads test"<<std::endl;
+    std::cout<< std::left
+             <<std::setw(16)<<"Threads"
+             <<std::setw(16)<<"Tree"
+             <<std::setw(16)<<"AVG reads/s"
+             <<std::setw(16)<<"worst"
+             <<std::setw(16)<<"best"
+             <<std::endl;
+    {
+        int N{baseN};
+        while((N<<1)<maxN){ N = N<<1;}
+        const int reads{1<<14};     // per reader thread
+        int* a{get_random_arr(N)};
+
+        Avlbst guarded;
+        std::mutex guard;
+        ConcurrentBst<int,double> concurrent;
+        for(int iii{0};iii<N;++iii){
+            guarded.emplace(a[iii],(double)a[iii]);
+            concurrent.emplace(a[iii],(double)a[iii]);
+        }
+
+        for(int n_threads: {1,2,4,8,16,32}){
+            bool first_row{true};
+            for(int write_pct: {0,1,10}){
+                for(bool seqlock: {false,true}){
+                    new_routine();
+                    for(int ttt{0};ttt<trials;++ttt){
+
+                        std::atomic<bool> go{false};
+                        double sums[32]{};
+
+                        auto reader = [&](int id){
+                            while(!go){ std::this_thread::yield();}
+                            double sum{0}, v{0};
+                            for(int iii{0};iii<reads;++iii){
+                                int key{a[(id*7919+iii)%N]};
+                                if(seqlock){
+                                    if(concurrent.find(key,v)){ sum += v;}
+                                }
+                                else{
+                                    std::lock_guard<std::mutex> lock{guard};
+                                    auto it{guarded.find(key)};
+                                    if(it!=guarded.end()){ sum += (*it).second;}
+                                }
+                            }
+                            sums[id] = sum;
+                        };
+
+                        auto writer = [&](){
+                            while(!go){ std::this_thread::yield();}
+                            int writes{int((long long)reads*n_threads*write_pct/100)};
+                            for(int iii{0};iii<writes;++iii){
+                                int key{a[iii%N]};
+                                if(seqlock){
+                                    concurrent.erase(key);
+                                    concurrent.emplace(key,(double)key);
+                                }
+                                else{
+                                    std::lock_guard<std::mutex> lock{guard};
+                                    guarded.erase(key);
+                                    guarded.emplace(key,(double)key);
+                                }
+                            }
+                        };
+
+                        std::vector<std::thread> threads;
+                        for(int iii{0};iii<n_threads;++iii){ threads.emplace_back(reader,iii);}
+                        threads.emplace_back(writer);
+
+                        start = std::chrono::steady_clock::now();
+                        go = true;
+                        for(auto& t: threads){ t.join();}
+                        end = std::chrono::steady_clock::now();
+
+                        for(int iii{0};iii<n_threads;++iii){
+                            if(sums[iii]<0){ std::cout<<sums[iii];}
+                        }
+                        finalize_trial();
+                    }
+                    // times to throughputs (the worst time gives the worst throughput)
+                    double n_reads{double(reads)*n_threads};
+                    std::cout<<std::setw(16)<<(first_row? std::to_string(n_threads) : "\"")
+                             <<std::setw(16)<<std::to_string(write_pct)+"% "+(seqlock? "seqlock" : "mutex")
+                             <<std::setw(16)<<n_reads/(acc/trials)
+                             <<std::setw(16)<<n_reads/worst
+                             <<std::setw(16)<<n_reads/best
+                             <<std::endl;
+                    first_row = false;
+                }
+            }
+        }
+        delete[] a;
+    }
+
+
+    //--------------------------------
+    // Lock-free test
+    //--------------------------------
+    std::cout<<"Lock-free test"<<std::endl;
+    std::cout<< std::left
+             <<std::setw(16)<<"Threads"
+             <<std::setw(16)<<"Tree"
+             <<std::setw(16)<<"AVG ops/s"
+             <<std::setw(16)<<"worst"
+             <<std::setw(16)<<"best"
+             <<std::endl;
+    {
+        int N{baseN};
+        while((N<<1)<maxN){ N = N<<1;}
+        const int ops{1<<14};       // per worker thread
+        int* a{get_random_arr(2*N)};
+
+        for(int n_threads: {1,2,4,8,16,32}){
+            bool first_row{true};
+            for(int write_pct: {10,50}){
+                for(bool lockfree: {false,true}){
+                    new_routine();
+                    for(int ttt{0};ttt<trials;++ttt){
+
+                        // keys 1...2N, half of them in the tree
+                        Avlbst guarded;
+                        std::mutex guard;
+                        LockFreeBst<int,double> lf;
+                        for(int iii{0};iii<N;++iii){
+                            if(lockfree){ lf.emplace(a[iii],(double)a[iii]);}
+                            else{ guarded.emplace(a[iii],(double)a[iii]);}
+                        }
+
+                        std::atomic<bool> go{false};
+                        double sums[32]{};
+
+                        auto worker = [&](int id){
+                            while(!go){ std::this_thread::yield();}
+                            double sum{0}, v{0};
+                            for(int iii{0};iii<ops;++iii){
+                                int key{a[(id*7919+iii*31)%(2*N)]};
+                                int op{(iii*37+id)%100};
+                                if(lockfree){
+                                    if(op>=write_pct){ if(lf.find(key,v)){ sum += v;}}
+                                    else if(op&1){ lf.erase(key);}
+                                    else{ lf.emplace(key,(double)key);}
+                                }
+                                else{
+                                    std::lock_guard<std::mutex> lock{guard};
+                                    if(op>=write_pct){
+                                        auto it{guarded.find(key)};
+                                        if(it!=guarded.end()){ sum += (*it).second;}
+                                    }
+                                    else if(op&1){ guarded.erase(key);}
+                                    else{ guarded.emplace(key,(double)key);}
+                                }
+                            }
+                            sums[id] = sum;
+                        };
+
+                        std::vector<std::thread> threads;
+                        for(int iii{0};iii<n_threads;++iii){ threads.emplace_back(worker,iii);}
+
+                        start = std::chrono::steady_clock::now();
+                        go = true;
+                        for(auto& t: threads){ t.join();}
+                        end = std::chrono::steady_clock::now();
+
+                        for(int iii{0};iii<n_threads;++iii){
+                            if(sums[iii]<0){ std::cout<<sums[iii];}
+                        }
+                        finalize_trial();
+                    }
+                    // times to throughputs (the worst time gives the worst throughput)
+                    double n_ops{double(ops)*n_threads};
+                    std::cout<<std::setw(16)<<(first_row? std::to_string(n_threads) : "\"")
+                             <<std::setw(16)<<std::to_string(write_pct)+"% "+(lockfree? "lockfree" : "mutex")
+                             <<std::setw(16)<<n_ops/(acc/trials)
+                             <<std::setw(16)<<n_ops/worst
+                             <<std::setw(16)<<n_ops/best
+                             <<std::endl;
+                    first_row = false;
+                }
+            }
+        }
+        delete[] a;
+    }
+
+
+    //--------------------------------
+    // Sharded insert test
+    //--------------------------------
+    std::cout<<"Sharded insert test"<<std::endl;
+    std::cout<< std::left
+             <<std::setw(16)<<"Threads"
+             <<std::setw(16)<<"Tree"
+             <<std::setw(16)<<"AVG inserts/s"
+             <<std::setw(16)<<"worst"
+             <<std::setw(16)<<"best"
+             <<std::endl;
+    {
+        int N{baseN};
+        while((N<<1)<maxN){ N = N<<1;}
+        const int seed{N/16};      // inserted before timing (sets the shard boundaries)
+        int* a{get_random_arr(N)};
+
+        for(int n_threads: {1,2,4,8,16,32}){
+            for(bool sharded: {false,true}){
+                new_routine();
+                for(int ttt{0};ttt<trials;++ttt){
+
+                    Avlbst guarded;
+                    std::mutex guard;
+                    ShardedBst<int,double> sb{64};
+                    for(int iii{0};iii<seed;++iii){
+                        if(sharded){ sb.emplace(a[iii],(double)a[iii]);}
+                        else{ guarded.emplace(a[iii],(double)a[iii]);}
+                    }
+                    sb.balance();
+
+                    std::atomic<bool> go{false};
+
+                    auto worker = [&](int id){
+                        while(!go){ std::this_thread::yield();}
+                        for(int iii{seed+id};iii<N;iii+=n_threads){
+                            if(sharded){
+                                sb.emplace(a[iii],(double)a[iii]);
+                            }
+                            else{
+                                std::lock_guard<std::mutex> lock{guard};
+                                guarded.emplace(a[iii],(double)a[iii]);
+                            }
+                        }
+                    };
+
+                    std::vector<std::thread> threads;
+                    for(int iii{0};iii<n_threads;++iii){ threads.emplace_back(worker,iii);}
+
+                    start = std::chrono::steady_clock::now();
+                    go = true;
+                    for(auto& t: threads){ t.join();}
+                    end = std::chrono::steady_clock::now();
+
+                    if((sharded? sb.get_size() : guarded.get_size())!=(unsigned int)N){
+                        std::cout<<"missing keys!"<<std::endl;
+                    }
+                    finalize_trial();
+                }
+                // times to throughputs (the worst time gives the worst throughput)
+                double n_inserts{double(N-seed)};
+                std::cout<<std::setw(16)<<(sharded? "\"" : std::to_string(n_threads))
+                         <<std::setw(16)<<(sharded? "sharded" : "mutex")
+                         <<std::setw(16)<<n_inserts/(acc/trials)
+                         <<std::setw(16)<<n_inserts/worst
+                         <<std::setw(16)<<n_inserts/best
+                         <<std::endl;
+            }
+        }
+        delete[] a;
+    }
+
+
+    //--------------------------------
+    // Set operations test
+    //--------------------------------
+    print_header("Set operations test");
+    for(int N{baseN};N<maxN;N=(N<<1)){
+        const int M{N/16};      // keys of the other tree, about half of them in both
+        int* a{get_random_arr(N)};
+        int* b{get_random_arr(2*N)};
+
+        for(const char* op: {"union","inter","diff"}){
+            for(bool join: {false,true}){
+                new_routine();
+                for(int ttt{0};ttt<trials;++ttt){
+
+                    Avlbst bst, other;
+                    for(int iii{0};iii<N;++iii){ bst.emplace(a[iii],(double)a[iii]);}
+                    for(int iii{0};iii<M;++iii){ other.emplace(b[iii],-(double)b[iii]);}
+
+                    start = std::chrono::steady_clock::now();
+                    if(op==std::string("union")){
+                        if(join){ bst.merge_from(std::move(other));}
+                        else{ for(auto it{other.cbegin()};it!=other.cend();++it){ bst[(*it).first] = (*it).second;}}
+                    }
+                    else if(op==std::string("inter")){
+                        if(join){ bst.intersect(other);}
+                        else{
+                            std::vector<int> drop;
+                            for(auto it{bst.cbegin()};it!=bst.cend();++it){
+                                if(!other.contains((*it).first)){ drop.push_back((*it).first);}
+                            }
+                            for(int k: drop){ bst.erase(k);}
+                        }
+                    }
+                    else{
+                        if(join){ bst.difference(other);}
+                        else{ for(auto it{other.cbegin()};it!=other.cend();++it){ bst.erase((*it).first);}}
+                    }
+                    end = std::chrono::steady_clock::now();
+
+                    finalize_trial();
+                }
+                print_row(op==std::string("union") && !join? std::to_string(N) : "\"",
+                          std::string(op)+(join? " join" : " loop"));
+            }
+        }
+        delete[] a;
+        delete[] b;
+    }
+
+
+    //--------------------------------
+    // Parallel build test
+    //--------------------------------
+    std::cout<<"Parallel build test"<<std::endl;
+    std::cout<< std::left
+             <<std::setw(16)<<"Threads"
+             <<std::setw(16)<<"Tree"
+             <<std::setw(16)<<"AVG"
+             <<std::setw(16)<<"worst"
+             <<std::setw(16)<<"best"
+             <<std::endl;
+    {
+        int N{baseN};
+        while((N<<1)<maxN){ N = N<<1;}
+        int* a{get_random_arr(N)};
+        std::vector<std::pair<int,double>> kvs;
+        kvs.reserve(N);
+        for(int iii{0};iii<N;++iii){ kvs.emplace_back(a[iii],(double)a[iii]);}
+
+        // single threaded bulk load first
+        new_routine();
+        for(int ttt{0};ttt<trials;++ttt){
+            start = std::chrono::steady_clock::now();
+            Avlbst bst(kvs.begin(),kvs.end(),range_order::unsorted);
+            end = std::chrono::steady_clock::now();
+            finalize_trial();
+        }
+        print_row("-","bulk");
+
+        for(int n_threads: {1,2,4,8,16,32}){
+            new_routine();
+            for(int ttt{0};ttt<trials;++ttt){
+                start = std::chrono::steady_clock::now();
+                Avlbst bst{Avlbst::build_parallel(kvs.begin(),kvs.end(),n_threads)};
+                end = std::chrono::steady_clock::now();
+                finalize_trial();
+            }
+            print_row(std::to_string(n_threads),"parallel");
+        }
+        delete[] a;
+    }
+
+
+    //--------------------------------
+    // Parallel reduce test
+    //--------------------------------
+    std::cout<<"Parallel reduce test"<<std::endl;
+    std::cout<< std::left
+             <<std::setw(16)<<"Threads"
+             <<std::setw(16)<<"Tree"
+             <<std::setw(16)<<"AVG"
+             <<std::setw(16)<<"worst"
+             <<std::setw(16)<<"best"
+             <<std::endl;
+    {
+        int N{baseN};
+        while((N<<1)<maxN){ N = N<<1;}
+        int* a{get_random_arr(N)};
+        Avlbst bst;
+        for(int iii{0};iii<N;++iii){ bst.emplace(a[iii],(double)a[iii]);}
+        const Avlbst& cbst{bst};
+        double expected{(double)N*(N+1)/2};
+
+        // single iterator walk first
+        new_routine();
+        for(int ttt{0};ttt<trials;++ttt){
+            double sum{0};
+            start = std::chrono::steady_clock::now();
+            for(auto it{cbst.cbegin()};it!=cbst.cend();++it){ sum += (*it).second;}
+            end = std::chrono::steady_clock::now();
+            if(sum!=expected){ std::cout<<"wrong sum!"<<std::endl;}
+            finalize_trial();
+        }
+        print_row("-","iterator");
+
+        for(int n_threads: {1,2,4,8,16,32}){
+            new_routine();
+            for(int ttt{0};ttt<trials;++ttt){
+                start = std::chrono::steady_clock::now();
+                double sum{cbst.parallel_reduce(0.0,std::plus<double>(),Avlbst::value_of{},n_threads)};
+                end = std::chrono::steady_clock::now();
+                if(sum!=expected){ std::cout<<"wrong sum!"<<std::endl;}
+                finalize_trial();
+            }
+            print_row(std::to_string(n_threads),"reduce");
+        }
+        delete[] a;
+    }
+
+
     //--------------------------------
     //--------------------------------
     
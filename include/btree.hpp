@@ -0,0 +1,1010 @@
+#pragma once
+
+#include <iostream>
+#include <exception>
+#include <stdexcept>    // for std::out_of_range
+#include <utility>      // for std::pair, std::move
+#include <functional>   // for std::less
+#include <type_traits>  // for std::is_same, std::enable_if
+#include <cstddef>      // for std::size_t
+#include <algorithm>    // for std::lower_bound, std::upper_bound, std::move_backward
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BTREE_SIMD
+#endif
+
+#include "bst.hpp"      // for range_order
+
+
+//-------------------
+// In-node key search
+//-------------------
+
+/// @brief Position of a key among the (sorted) keys of a node.
+///
+/// Generic version: binary search with cmp.
+///
+/// @tparam K       Type of the keys
+/// @tparam cmp     Comparator class
+template< class K, class cmp, class = void >
+struct btree_search{
+
+    /// @brief Position of the first key not less than key.
+    static unsigned int lower(const K* keys, unsigned int n, const K& key){
+        return static_cast<unsigned int>(std::lower_bound(keys,keys+n,key,cmp())-keys);
+    }
+
+    /// @brief Position of the first key greater than key.
+    static unsigned int upper(const K* keys, unsigned int n, const K& key){
+        return static_cast<unsigned int>(std::upper_bound(keys,keys+n,key,cmp())-keys);
+    }
+};
+
+#if defined(BTREE_SIMD)
+
+/// @brief Sum of the 32-bit lanes of a register.
+inline unsigned int btree_hsum32(__m128i v) noexcept{
+    v = _mm_add_epi32(v,_mm_shuffle_epi32(v,_MM_SHUFFLE(1,0,3,2)));
+    v = _mm_add_epi32(v,_mm_shuffle_epi32(v,_MM_SHUFFLE(2,3,0,1)));
+    return static_cast<unsigned int>(_mm_cvtsi128_si32(v));
+}
+
+/// @brief Sum of the 64-bit lanes of a register.
+inline unsigned int btree_hsum64(__m128i v) noexcept{
+    v = _mm_add_epi64(v,_mm_shuffle_epi32(v,_MM_SHUFFLE(1,0,3,2)));
+    return static_cast<unsigned int>(_mm_cvtsi128_si32(v));
+}
+
+/// @brief Vectorised counting of the keys of a node smaller (greater) than a given one.
+///
+/// Keys are compared with the probe a whole register at a time (SSE2, or AVX2
+/// when enabled at compile time, e.g. by -march=native): each comparison gives
+/// all ones (-1) in the lanes where it holds, which are subtracted from per-lane
+/// counters summed up once at the end. Leftovers are counted one by one.
+/// As keys are sorted the count is also the position of the bound, and no branch
+/// depends on the keys.
+/// Only defined for the key types SIMD can compare natively.
+///
+/// @tparam K       Type of the keys
+/// @tparam size    sizeof(K)
+/// @tparam fp      whether K is a floating point type
+template< class K, std::size_t size = sizeof(K), bool fp = std::is_floating_point<K>::value >
+struct btree_simd_count;
+
+/// @brief 32-bit signed integers.
+template< class K >
+struct btree_simd_count<K,4,false>{
+    template< bool greater >
+    static unsigned int count(const K* keys, unsigned int n, K key) noexcept{
+        unsigned int iii{0};
+        __m128i acc = _mm_setzero_si128();
+#if defined(__AVX2__)
+        const __m256i k8 = _mm256_set1_epi32(static_cast<int>(key));
+        __m256i acc8 = _mm256_setzero_si256();
+        for(; iii+8<=n; iii+=8){
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys+iii));
+            acc8 = _mm256_sub_epi32(acc8, greater? _mm256_cmpgt_epi32(v,k8) : _mm256_cmpgt_epi32(k8,v));
+        }
+        acc = _mm_add_epi32(_mm256_castsi256_si128(acc8),_mm256_extracti128_si256(acc8,1));
+#endif
+        const __m128i k4 = _mm_set1_epi32(static_cast<int>(key));
+        for(; iii+4<=n; iii+=4){
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys+iii));
+            acc = _mm_sub_epi32(acc, greater? _mm_cmpgt_epi32(v,k4) : _mm_cmplt_epi32(v,k4));
+        }
+        unsigned int c{btree_hsum32(acc)};
+        for(; iii<n; ++iii){ c += greater? key<keys[iii] : keys[iii]<key;}
+        return c;
+    }
+};
+
+/// @brief 64-bit signed integers (a 64-bit compare needs SSE4.2).
+template< class K >
+struct btree_simd_count<K,8,false>{
+    template< bool greater >
+    static unsigned int count(const K* keys, unsigned int n, K key) noexcept{
+        unsigned int iii{0};
+        __m128i acc = _mm_setzero_si128();
+#if defined(__AVX2__)
+        const __m256i k4 = _mm256_set1_epi64x(static_cast<long long>(key));
+        __m256i acc4 = _mm256_setzero_si256();
+        for(; iii+4<=n; iii+=4){
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys+iii));
+            acc4 = _mm256_sub_epi64(acc4, greater? _mm256_cmpgt_epi64(v,k4) : _mm256_cmpgt_epi64(k4,v));
+        }
+        acc = _mm_add_epi64(_mm256_castsi256_si128(acc4),_mm256_extracti128_si256(acc4,1));
+#endif
+#if defined(__SSE4_2__)
+        const __m128i k2 = _mm_set1_epi64x(static_cast<long long>(key));
+        for(; iii+2<=n; iii+=2){
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys+iii));
+            acc = _mm_sub_epi64(acc, greater? _mm_cmpgt_epi64(v,k2) : _mm_cmpgt_epi64(k2,v));
+        }
+#endif
+        unsigned int c{btree_hsum64(acc)};
+        for(; iii<n; ++iii){ c += greater? key<keys[iii] : keys[iii]<key;}
+        return c;
+    }
+};
+
+/// @brief float.
+template< class K >
+struct btree_simd_count<K,4,true>{
+    template< bool greater >
+    static unsigned int count(const K* keys, unsigned int n, K key) noexcept{
+        unsigned int iii{0};
+        __m128i acc = _mm_setzero_si128();
+#if defined(__AVX2__)
+        const __m256 k8 = _mm256_set1_ps(key);
+        __m256i acc8 = _mm256_setzero_si256();
+        for(; iii+8<=n; iii+=8){
+            __m256 v = _mm256_loadu_ps(keys+iii);
+            __m256 m = greater? _mm256_cmp_ps(v,k8,_CMP_GT_OQ) : _mm256_cmp_ps(v,k8,_CMP_LT_OQ);
+            acc8 = _mm256_sub_epi32(acc8,_mm256_castps_si256(m));
+        }
+        acc = _mm_add_epi32(_mm256_castsi256_si128(acc8),_mm256_extracti128_si256(acc8,1));
+#endif
+        const __m128 k4 = _mm_set1_ps(key);
+        for(; iii+4<=n; iii+=4){
+            __m128 v = _mm_loadu_ps(keys+iii);
+            __m128 m = greater? _mm_cmpgt_ps(v,k4) : _mm_cmplt_ps(v,k4);
+            acc = _mm_sub_epi32(acc,_mm_castps_si128(m));
+        }
+        unsigned int c{btree_hsum32(acc)};
+        for(; iii<n; ++iii){ c += greater? key<keys[iii] : keys[iii]<key;}
+        return c;
+    }
+};
+
+/// @brief double.
+template< class K >
+struct btree_simd_count<K,8,true>{
+    template< bool greater >
+    static unsigned int count(const K* keys, unsigned int n, K key) noexcept{
+        unsigned int iii{0};
+        __m128i acc = _mm_setzero_si128();
+#if defined(__AVX2__)
+        const __m256d k4 = _mm256_set1_pd(key);
+        __m256i acc4 = _mm256_setzero_si256();
+        for(; iii+4<=n; iii+=4){
+            __m256d v = _mm256_loadu_pd(keys+iii);
+            __m256d m = greater? _mm256_cmp_pd(v,k4,_CMP_GT_OQ) : _mm256_cmp_pd(v,k4,_CMP_LT_OQ);
+            acc4 = _mm256_sub_epi64(acc4,_mm256_castpd_si256(m));
+        }
+        acc = _mm_add_epi64(_mm256_castsi256_si128(acc4),_mm256_extracti128_si256(acc4,1));
+#endif
+        const __m128d k2 = _mm_set1_pd(key);
+        for(; iii+2<=n; iii+=2){
+            __m128d v = _mm_loadu_pd(keys+iii);
+            __m128d m = greater? _mm_cmpgt_pd(v,k2) : _mm_cmplt_pd(v,k2);
+            acc = _mm_sub_epi64(acc,_mm_castpd_si128(m));
+        }
+        unsigned int c{btree_hsum64(acc)};
+        for(; iii<n; ++iii){ c += greater? key<keys[iii] : keys[iii]<key;}
+        return c;
+    }
+};
+
+/// @brief Whether keys of type K compared by cmp can be searched with SIMD:
+///        std::less on float, double or 32/64-bit signed integers.
+template< class K, class cmp >
+struct btree_simd_key: std::integral_constant<bool,
+        std::is_same<cmp,std::less<K>>::value
+        && (std::is_floating_point<K>::value || (std::is_integral<K>::value && std::is_signed<K>::value))
+        && (sizeof(K)==4 || sizeof(K)==8)>{};
+
+/// @brief SIMD version: keys are counted instead of binary searched
+///        (nodes are a few cache lines wide, a linear vectorised scan beats
+///        the unpredictable branches of a binary search).
+template< class K, class cmp >
+struct btree_search<K,cmp,typename std::enable_if<btree_simd_key<K,cmp>::value>::type>{
+
+    static unsigned int lower(const K* keys, unsigned int n, const K& key) noexcept{
+        return btree_simd_count<K>::template count<false>(keys,n,key);
+    }
+
+    static unsigned int upper(const K* keys, unsigned int n, const K& key) noexcept{
+        return n-btree_simd_count<K>::template count<true>(keys,n,key);
+    }
+};
+
+#endif
+
+
+//------
+// BTree
+//------
+
+/// @brief Cache-conscious ordered map: a B+-tree.
+///
+/// Same interface as Bst (see bst.hpp), different storage engine:
+/// nodes hold up to `slots` sorted keys each (enough to fill 256 bytes, that is
+/// four cache lines, with at least 8 keys), so that a search touches a handful
+/// of wide nodes instead of ~log2(N) scattered ones. Key/value pairs live in the
+/// leaves only, which are linked in cmp order: iteration is a scan of contiguous
+/// arrays. Inner nodes only hold keys routing the search.
+///
+/// Within a node keys are searched with SIMD comparisons for std::less on
+/// arithmetic keys (see btree_search), with a binary search otherwise.
+///
+/// Differences from Bst:
+/// - K and V must be default constructible and move assignable (node slots are arrays)
+/// - insert() and erase() move elements within and across nodes, hence they
+///   invalidate iterators
+/// - dereferencing an iterator gives a (key,value) pair of references by value,
+///   so range-for loops should use `auto` or `const auto&` instead of `auto&`
+/// - get_height() is the number of levels below the root, balance() does nothing
+///   as the tree is always balanced
+///
+/// @tparam K       Type of the keys
+/// @tparam V       Type of the values
+/// @tparam cmp     Comparator class (default: std::less<K>)
+template< class K, class V, class cmp = std::less<K> >
+class BTree{
+
+  public:
+    using kvpair = std::pair<const K,V>;
+
+    /// @brief Maximum number of keys in a node.
+    static constexpr unsigned int slots{256/sizeof(K)<8? 8 : static_cast<unsigned int>(256/sizeof(K))/2*2};
+
+  private:
+
+    using search = btree_search<K,cmp>;
+
+    /// @brief Nodes (but the root) never hold fewer keys than this after an erase.
+    static constexpr unsigned int min_keys{slots/2};
+
+    /// @brief Bound on the number of levels (every inner node but the root
+    ///        has at least min_keys+1>=5 children, 2^32 elements fit in 16 levels).
+    static constexpr int max_levels{32};
+
+    struct Node{
+        unsigned int n{0};  ///< number of keys
+    };
+
+    struct Leaf: Node{
+        K keys[slots];
+        V values[slots];
+        Leaf* prev{nullptr};
+        Leaf* next{nullptr};
+    };
+
+    struct Inner: Node{
+        K keys[slots];              ///< keys of children[i] < keys[i] <= keys of children[i+1]
+        Node* children[slots+1];
+    };
+
+    /// @brief Inner nodes met during a descent and the child followed in each of them.
+    struct Path{
+        Inner* node[max_levels];
+        unsigned int slot[max_levels];
+    };
+
+    Node* root{nullptr};
+    int levels{0};              ///< inner levels above the leaves
+    Leaf* first{nullptr};       ///< leftmost leaf
+    unsigned int size{0};
+
+    /// @brief Walks down from the root to the leaf where key belongs.
+    ///
+    /// @param key      key to look for
+    /// @param path     (out) inner nodes met and children followed
+    /// @return Leaf*   the leaf (root must not be null)
+    Leaf* descend(const K& key, Path& path) const;
+
+    /// @brief Walks down from the root to the leaf where key belongs.
+    Leaf* descend(const K& key) const;
+
+    /// @brief Deep copy of the subtree rooted at n (leaves are linked to prev_leaf on the go).
+    ///
+    /// @param n            subtree root
+    /// @param depth        inner levels below n
+    /// @param prev_leaf    (in/out) last leaf copied so far
+    /// @return Node*       the copy
+    static Node* copy_rec(const Node* n, int depth, Leaf*& prev_leaf);
+
+    /// @brief Frees the subtree rooted at n. Recursion depth is the (logarithmic) tree height.
+    ///
+    /// @param n        subtree root
+    /// @param depth    inner levels below n
+    static void destroy_rec(Node* n, int depth) noexcept;
+
+    /// @brief Base template iterator class.
+    ///
+    /// @tparam L       Leaf or const Leaf
+    /// @tparam KV      Type returned by dereference op (a pair of references)
+    template<class L, class KV>
+    class _iterator{
+
+        L* leaf;            ///< current leaf (nullptr: end)
+        unsigned int slot;  ///< position in the leaf
+
+        friend class BTree;
+        template<class,class> friend class _iterator;
+
+      public:
+        _iterator(L* l, unsigned int s): leaf(l), slot(s){};
+
+        /// @brief Conversion from iterator to const_iterator.
+        ///
+        /// @param it iterator to convert
+        template<class L2, class KV2, class = typename std::enable_if<std::is_same<const L2,L>::value>::type>
+        _iterator(const _iterator<L2,KV2>& it): leaf(it.leaf), slot(it.slot){};
+
+        bool operator==(const _iterator& rhs) const{return leaf == rhs.leaf && slot == rhs.slot;}
+        bool operator!=(const _iterator& rhs) const{return !(*this == rhs);}
+
+        /// @brief pre-increment.
+        _iterator& operator++(){
+            if(leaf && ++slot==leaf->n){
+                leaf = leaf->next;
+                slot = 0;
+            }
+            return *this;
+        }
+
+        /// @brief post-increment.
+        _iterator operator++(int){
+            _iterator cp{*this};
+            ++(*this);
+            return cp;
+        }
+
+        /// @brief de-reference op.
+        ///
+        /// @return KV (key,value) references
+        KV operator*() const{
+            if(!leaf){
+                throw std::out_of_range("BTree iterator out of range!");
+            }
+            return KV{leaf->keys[slot], leaf->values[slot]};
+        }
+    };
+
+  public:
+
+    // ctors, dtors -----------------------------------------------------------
+    BTree() = default;
+
+    /// @brief Range ctor. See assign().
+    ///
+    /// @tparam It      forward iterator to std::pair<K,V> (or kvpair)
+    /// @param first    range begin
+    /// @param last     range end
+    /// @param order    how the range is ordered (default: sorted)
+    template< class It >
+    BTree(It first, It last, range_order order = range_order::sorted){
+        assign(first,last,order);
+    }
+
+    ~BTree(){ clear();}
+
+    // copy/move semantics ----------------------------------------------------
+
+    /// @brief Copy ctor. Node by node deep copy (the shape is kept).
+    ///
+    /// @param bt tree to copy
+    BTree(const BTree& bt);
+
+    BTree(BTree&& bt) noexcept{ swap(bt);}
+
+    BTree& operator=(const BTree& rhs){
+        BTree tmp{rhs};
+        swap(tmp);
+        return *this;
+    }
+
+    BTree& operator=(BTree&& rhs) noexcept{
+        if(this != &rhs){
+            clear();
+            swap(rhs);
+        }
+        return *this;
+    }
+
+    void swap(BTree& other) noexcept{
+        std::swap(root,other.root);
+        std::swap(levels,other.levels);
+        std::swap(first,other.first);
+        std::swap(size,other.size);
+    }
+
+    // Iterator interface -----------------------------------------------------
+
+    typedef _iterator<Leaf, std::pair<const K&,V&>> iterator;
+    typedef _iterator<const Leaf, std::pair<const K&,const V&>> const_iterator;
+
+    inline iterator begin(){ return iterator{first,0};}
+    inline const_iterator begin() const{ return const_iterator{first,0};}
+    inline const_iterator cbegin() const{ return const_iterator{first,0};}
+
+    inline iterator end(){ return iterator{nullptr,0};}
+    inline const_iterator end() const{ return const_iterator{nullptr,0};}
+    inline const_iterator cend() const{ return const_iterator{nullptr,0};}
+
+    //---------------
+    // Node insertion
+    //---------------
+
+  private:
+
+    /// @brief Inserts key with a value built from vargs, unless key is already present.
+    ///
+    /// Full nodes on the way are split in two halves, except when appending past
+    /// the last key of the tree: then the full nodes are left (almost) as they are
+    /// and the new key starts new ones, so that sorted loads fill nodes up.
+    ///
+    /// @param key      key to insert (moved only if inserted)
+    /// @param vargs    values forwarded to V ctor
+    /// @return std::pair<iterator, bool> iterator to element at given key + if insertion was successful
+    template< class KT, class... VArgs >
+    std::pair<iterator, bool> insert_unique(KT&& key, VArgs&&... vargs);
+
+  public:
+
+    /// @brief Inserts a new element by moving given key/value pair.
+    ///
+    /// If given key is already used the tree is left unchanged.
+    ///
+    /// @param kv   key/value pair to move
+    /// @return std::pair<iterator, bool> iterator to element at given key + if insertion was successful
+    std::pair<iterator, bool> insert(kvpair&& kv){ return insert_unique(kv.first,std::move(kv.second));}
+
+    /// @brief Inserts a new element by copying given key/value pair.
+    ///
+    /// If given key is already used the tree is left unchanged.
+    ///
+    /// @param kv   key/value pair to copy
+    /// @return std::pair<iterator, bool> iterator to element at given key + if insertion was successful
+    std::pair<iterator, bool> insert(const kvpair& kv){ return insert_unique(kv.first,kv.second);}
+
+    /// @brief Inserts a new element by creating its value from given args.
+    ///
+    /// If given key is already used the tree is left unchanged.
+    ///
+    /// @tparam vctorargtypes   argument types of V ctor
+    /// @param key              key value to insert the element at (if not present)
+    /// @param vctorargs        values forwarded to V ctor
+    /// @return std::pair<iterator, bool> iterator to element at given key + if insertion was successful
+    template< class... vctorargtypes >
+    std::pair<iterator, bool> emplace(const K& key, vctorargtypes&&... vctorargs){
+        return insert_unique(key,std::forward<vctorargtypes>(vctorargs)...);
+    }
+
+    /// @brief Replaces the content of the tree with the pairs of a range,
+    ///        inserted one by one (only the first of equal keys is kept).
+    ///        Sorted ranges end up in full nodes.
+    ///
+    /// @tparam It      input iterator to std::pair<K,V> (or kvpair)
+    /// @param first    range begin
+    /// @param last     range end
+    /// @param order    unused: any order works (kept for interface compatibility with Bst)
+    template< class It >
+    void assign(It first, It last, range_order order = range_order::sorted){
+        (void)order;
+        clear();
+        for(; first!=last; ++first){
+            insert_unique((*first).first,(*first).second);
+        }
+    }
+
+    //------------
+    // Node access
+    //------------
+
+  private:
+
+    /// @brief Base find method.
+    ///
+    /// @tparam It      iterator or const_iterator
+    /// @param key      Key to find
+    /// @return It      iterator to the element found (or end())
+    template< class It >
+    It _find(const K& key) const;
+
+    /// @brief Leaf and slot of the first key not less (lower) or greater (!lower) than key.
+    template< class It >
+    It bound(const K& key, bool lower) const;
+
+  public:
+
+    /// @brief returns an iterator to given key (or to end() if none was found).
+    inline iterator find(const K& key){ return _find<iterator>(key);}
+    inline const_iterator find(const K& key) const{ return _find<const_iterator>(key);}
+
+    /// @brief Whether given key is present.
+    inline bool contains(const K& key) const{ return find(key)!=cend();}
+
+    /// @brief Iterator to the first element whose key is not less than key.
+    inline iterator lower_bound(const K& key){ return bound<iterator>(key,true);}
+    inline const_iterator lower_bound(const K& key) const{ return bound<const_iterator>(key,true);}
+
+    /// @brief Iterator to the first element whose key is greater than key.
+    inline iterator upper_bound(const K& key){ return bound<iterator>(key,false);}
+    inline const_iterator upper_bound(const K& key) const{ return bound<const_iterator>(key,false);}
+
+    /// @brief returns a r/w reference to value at given key (eventually initializing it).
+    ///
+    /// @param key        key of the element to return
+    /// @return V&        reference to the element at key (initializes it if not present already)
+    V& operator[](const K& key){ return (*insert_unique(key).first).second;}
+
+    /// @brief returns a r/w reference to value at given key (eventually initializing it).
+    ///
+    /// @param key        key of the element to return (moved only if inserted)
+    /// @return V&        reference to the element at key (initializes it if not present already)
+    V& operator[](K&& key){ return (*insert_unique(std::move(key)).first).second;}
+
+    //-------------
+    // Node removal
+    //-------------
+
+  private:
+
+    /// @brief Restores the minimum occupancy of a leaf that lost a key, by borrowing
+    ///        a key from a sibling or merging with it, up to the root.
+    ///
+    /// @param leaf     leaf that lost a key
+    /// @param path     descent path to leaf
+    void fix_after_erase(Leaf* leaf, Path& path) noexcept;
+
+  public:
+
+    /// @brief Remove the element at given key (if present). Invalidates iterators.
+    ///
+    /// @param key Key of the element to remove
+    void erase(const K& key);
+
+    /// @brief Clears the content of the tree.
+    void clear() noexcept{
+        if(root){ destroy_rec(root,levels);}
+        root = nullptr;
+        levels = 0;
+        first = nullptr;
+        size = 0;
+    }
+
+    //-------
+    // Output
+    //-------
+
+    /// @brief Getter for tree size.
+    ///
+    /// @return unsigned int tree's size
+    unsigned int get_size() const noexcept{return size;}
+
+    /// @brief Getter for tree height: levels below the root.
+    ///
+    /// @return int tree's height (-1 if empty)
+    int get_height() const noexcept{return root? levels : -1;}
+
+    /// @brief Sends string representation of the tree to ostream.
+    ///
+    /// @param os               output stream
+    /// @param bt               current object
+    /// @return std::ostream&   the ostream, to allow chained call
+    friend
+    std::ostream& operator<< (std::ostream& os, const BTree& bt){
+        os<<"size:"<<bt.get_size()<<" height:"<<bt.get_height()<<"\n";
+        for (const auto& kv:bt){
+            os<<"("<<kv.first<<","<<kv.second<<") ";
+        }
+        return os;
+    }
+
+    //--------
+    // Balance
+    //--------
+
+    /// @brief Does nothing: all the leaves of a B-tree are at the same depth.
+    void balance() noexcept{}
+};
+
+
+//#############################################################################
+//DEFINITIONS
+//#############################################################################
+
+template< class K, class V, class cmp >
+constexpr unsigned int BTree<K,V,cmp>::slots;
+
+template< class K, class V, class cmp >
+constexpr unsigned int BTree<K,V,cmp>::min_keys;
+
+template< class K, class V, class cmp >
+typename BTree<K,V,cmp>::Leaf* BTree<K,V,cmp>::descend(const K& key, Path& path) const{
+    Node* n{root};
+    for(int d{0}; d<levels; ++d){
+        Inner* in{static_cast<Inner*>(n)};
+        unsigned int s{search::upper(in->keys,in->n,key)};
+        path.node[d] = in;
+        path.slot[d] = s;
+        n = in->children[s];
+    }
+    return static_cast<Leaf*>(n);
+}
+
+template< class K, class V, class cmp >
+typename BTree<K,V,cmp>::Leaf* BTree<K,V,cmp>::descend(const K& key) const{
+    Node* n{root};
+    for(int d{0}; d<levels; ++d){
+        Inner* in{static_cast<Inner*>(n)};
+        n = in->children[search::upper(in->keys,in->n,key)];
+    }
+    return static_cast<Leaf*>(n);
+}
+
+// copy and teardown
+
+template< class K, class V, class cmp >
+typename BTree<K,V,cmp>::Node* BTree<K,V,cmp>::copy_rec(const Node* n, int depth, Leaf*& prev_leaf){
+    if(depth==0){
+        const Leaf* l{static_cast<const Leaf*>(n)};
+        Leaf* c{new Leaf};
+        c->n = l->n;
+        try{
+            std::copy(l->keys,l->keys+l->n,c->keys);
+            std::copy(l->values,l->values+l->n,c->values);
+        }
+        catch(...){
+            delete c;
+            throw;
+        }
+        c->prev = prev_leaf;
+        if(prev_leaf){ prev_leaf->next = c;}
+        prev_leaf = c;
+        return c;
+    }
+
+    const Inner* in{static_cast<const Inner*>(n)};
+    Inner* c{new Inner};
+    unsigned int copied{0};
+    try{
+        std::copy(in->keys,in->keys+in->n,c->keys);
+        for(; copied<=in->n; ++copied){
+            c->children[copied] = copy_rec(in->children[copied],depth-1,prev_leaf);
+        }
+    }
+    catch(...){
+        for(unsigned int iii{0}; iii<copied; ++iii){
+            destroy_rec(c->children[iii],depth-1);
+        }
+        delete c;
+        throw;
+    }
+    c->n = in->n;
+    return c;
+}
+
+template< class K, class V, class cmp >
+void BTree<K,V,cmp>::destroy_rec(Node* n, int depth) noexcept{
+    if(depth==0){
+        delete static_cast<Leaf*>(n);
+        return;
+    }
+    Inner* in{static_cast<Inner*>(n)};
+    for(unsigned int iii{0}; iii<=in->n; ++iii){
+        destroy_rec(in->children[iii],depth-1);
+    }
+    delete in;
+}
+
+template< class K, class V, class cmp >
+BTree<K,V,cmp>::BTree(const BTree& bt): levels{bt.levels}, size{bt.size}{
+    if(bt.root){
+        Leaf* last_leaf{nullptr};
+        root = copy_rec(bt.root,levels,last_leaf);
+        // leftmost leaf: walk down the first children
+        Node* n{root};
+        for(int d{0}; d<levels; ++d){ n = static_cast<Inner*>(n)->children[0];}
+        first = static_cast<Leaf*>(n);
+    }
+}
+
+// insertion
+
+template< class K, class V, class cmp >
+template< class KT, class... VArgs >
+std::pair<typename BTree<K,V,cmp>::iterator, bool> BTree<K,V,cmp>::insert_unique(KT&& key, VArgs&&... vargs){
+
+    // empty tree: the root is a leaf
+    if(!root){
+        Leaf* l{new Leaf};
+        try{
+            l->keys[0] = std::forward<KT>(key);
+            l->values[0] = V(std::forward<VArgs>(vargs)...);
+        }
+        catch(...){
+            delete l;
+            throw;
+        }
+        l->n = 1;
+        root = first = l;
+        size = 1;
+        return std::make_pair(iterator{l,0},true);
+    }
+
+    Path path;
+    Leaf* leaf{descend(key,path)};
+    unsigned int pos{search::lower(leaf->keys,leaf->n,key)};
+    if(pos<leaf->n && !cmp()(key,leaf->keys[pos])){
+        return std::make_pair(iterator{leaf,pos},false);
+    }
+
+    // build the new element first, and get every node a split may need:
+    // if anything throws, the tree is still untouched
+    K k(std::forward<KT>(key));
+    V v(std::forward<VArgs>(vargs)...);
+
+    int full_levels{0};     // full inner nodes right above the leaf, that will split too
+    Leaf* new_leaf{nullptr};
+    Inner* new_inners[max_levels+1];
+    if(leaf->n==slots){
+        while(full_levels<levels && path.node[levels-1-full_levels]->n==slots){ ++full_levels;}
+        new_leaf = new Leaf;
+        int iii{0};
+        try{
+            // one more inner node per full level, plus a new root if they are all full
+            for(; iii<full_levels+(full_levels==levels? 1 : 0); ++iii){
+                new_inners[iii] = new Inner;
+            }
+        }
+        catch(...){
+            while(iii>0){ delete new_inners[--iii];}
+            delete new_leaf;
+            throw;
+        }
+    }
+
+    ++size;
+
+    // room in the leaf: shift and store
+    if(!new_leaf){
+        std::move_backward(leaf->keys+pos,leaf->keys+leaf->n,leaf->keys+leaf->n+1);
+        std::move_backward(leaf->values+pos,leaf->values+leaf->n,leaf->values+leaf->n+1);
+        leaf->keys[pos] = std::move(k);
+        leaf->values[pos] = std::move(v);
+        ++leaf->n;
+        return std::make_pair(iterator{leaf,pos},true);
+    }
+
+    // split the leaf: the upper part goes to the new one
+    bool append{pos==slots && !leaf->next};
+    unsigned int split{append? slots : slots/2};
+    std::move(leaf->keys+split,leaf->keys+slots,new_leaf->keys);
+    std::move(leaf->values+split,leaf->values+slots,new_leaf->values);
+    new_leaf->n = slots-split;
+    leaf->n = split;
+
+    new_leaf->next = leaf->next;
+    new_leaf->prev = leaf;
+    if(leaf->next){ leaf->next->prev = new_leaf;}
+    leaf->next = new_leaf;
+
+    Leaf* target{leaf};
+    if(pos>split || append){
+        target = new_leaf;
+        pos -= split;
+    }
+    std::move_backward(target->keys+pos,target->keys+target->n,target->keys+target->n+1);
+    std::move_backward(target->values+pos,target->values+target->n,target->values+target->n+1);
+    target->keys[pos] = std::move(k);
+    target->values[pos] = std::move(v);
+    ++target->n;
+    iterator result{target,pos};
+
+    // push the separator up, splitting the full inner nodes on the way
+    K sep{new_leaf->keys[0]};
+    Node* right{new_leaf};
+    for(int d{levels-1}, used{0}; ; --d){
+
+        // the root split: grow a new one
+        if(d<0){
+            Inner* r{new_inners[used]};
+            r->keys[0] = std::move(sep);
+            r->children[0] = root;
+            r->children[1] = right;
+            r->n = 1;
+            root = r;
+            ++levels;
+            break;
+        }
+
+        Inner* in{path.node[d]};
+        unsigned int s{path.slot[d]};   // right goes at s+1, sep at s
+
+        if(in->n<slots){
+            std::move_backward(in->keys+s,in->keys+in->n,in->keys+in->n+1);
+            std::move_backward(in->children+s+1,in->children+in->n+1,in->children+in->n+2);
+            in->keys[s] = std::move(sep);
+            in->children[s+1] = right;
+            ++in->n;
+            break;
+        }
+
+        // full: lay the slots+1 keys out in order, keep the lower part,
+        // move the upper part to a new node and push the middle key up
+        K keys[slots+1];
+        Node* children[slots+2];
+        std::move(in->keys,in->keys+s,keys);
+        keys[s] = std::move(sep);
+        std::move(in->keys+s,in->keys+slots,keys+s+1);
+        std::copy(in->children,in->children+s+1,children);
+        children[s+1] = right;
+        std::copy(in->children+s+1,in->children+slots+1,children+s+2);
+
+        unsigned int mid{append? slots-1 : slots/2};
+        Inner* r{new_inners[used++]};
+        std::move(keys,keys+mid,in->keys);
+        std::copy(children,children+mid+1,in->children);
+        in->n = mid;
+        std::move(keys+mid+1,keys+slots+1,r->keys);
+        std::copy(children+mid+1,children+slots+2,r->children);
+        r->n = slots-mid;
+
+        sep = std::move(keys[mid]);
+        right = r;
+    }
+
+    return std::make_pair(result,true);
+}
+
+// access
+
+template< class K, class V, class cmp >
+template< class It >
+It BTree<K,V,cmp>::_find(const K& key) const{
+    if(!root){
+        return It{nullptr,0};
+    }
+    Leaf* leaf{descend(key)};
+    unsigned int pos{search::lower(leaf->keys,leaf->n,key)};
+    if(pos<leaf->n && !cmp()(key,leaf->keys[pos])){
+        return It{leaf,pos};
+    }
+    return It{nullptr,0};
+}
+
+template< class K, class V, class cmp >
+template< class It >
+It BTree<K,V,cmp>::bound(const K& key, bool lower) const{
+    if(!root){
+        return It{nullptr,0};
+    }
+    Leaf* leaf{descend(key)};
+    unsigned int pos{lower? search::lower(leaf->keys,leaf->n,key) : search::upper(leaf->keys,leaf->n,key)};
+    // past the end of the leaf: the bound is the first key of the next one
+    if(pos==leaf->n){
+        return It{leaf->next,0};
+    }
+    return It{leaf,pos};
+}
+
+// removal
+
+template< class K, class V, class cmp >
+void BTree<K,V,cmp>::erase(const K& key){
+    if(!root){
+        return;
+    }
+    Path path;
+    Leaf* leaf{descend(key,path)};
+    unsigned int pos{search::lower(leaf->keys,leaf->n,key)};
+    if(pos==leaf->n || cmp()(key,leaf->keys[pos])){
+        return;
+    }
+
+    std::move(leaf->keys+pos+1,leaf->keys+leaf->n,leaf->keys+pos);
+    std::move(leaf->values+pos+1,leaf->values+leaf->n,leaf->values+pos);
+    --leaf->n;
+    --size;
+
+    fix_after_erase(leaf,path);
+}
+
+template< class K, class V, class cmp >
+void BTree<K,V,cmp>::fix_after_erase(Leaf* leaf, Path& path) noexcept{
+    Node* n{leaf};
+    for(int d{levels-1}; d>=0 && n->n<min_keys; --d){
+        Inner* p{path.node[d]};
+        unsigned int s{path.slot[d]};
+        bool at_leaves{d==levels-1};
+
+        // 1. borrow the last key of the left sibling
+        if(s>0 && p->children[s-1]->n>min_keys){
+            if(at_leaves){
+                Leaf* l{static_cast<Leaf*>(p->children[s-1])};
+                Leaf* c{static_cast<Leaf*>(n)};
+                std::move_backward(c->keys,c->keys+c->n,c->keys+c->n+1);
+                std::move_backward(c->values,c->values+c->n,c->values+c->n+1);
+                c->keys[0] = std::move(l->keys[l->n-1]);
+                c->values[0] = std::move(l->values[l->n-1]);
+                p->keys[s-1] = c->keys[0];
+                --l->n;
+                ++c->n;
+            }
+            else{
+                Inner* l{static_cast<Inner*>(p->children[s-1])};
+                Inner* c{static_cast<Inner*>(n)};
+                std::move_backward(c->keys,c->keys+c->n,c->keys+c->n+1);
+                std::move_backward(c->children,c->children+c->n+1,c->children+c->n+2);
+                c->keys[0] = std::move(p->keys[s-1]);
+                c->children[0] = l->children[l->n];
+                p->keys[s-1] = std::move(l->keys[l->n-1]);
+                --l->n;
+                ++c->n;
+            }
+            return;
+        }
+
+        // 2. borrow the first key of the right sibling
+        if(s<p->n && p->children[s+1]->n>min_keys){
+            if(at_leaves){
+                Leaf* r{static_cast<Leaf*>(p->children[s+1])};
+                Leaf* c{static_cast<Leaf*>(n)};
+                c->keys[c->n] = std::move(r->keys[0]);
+                c->values[c->n] = std::move(r->values[0]);
+                ++c->n;
+                std::move(r->keys+1,r->keys+r->n,r->keys);
+                std::move(r->values+1,r->values+r->n,r->values);
+                --r->n;
+                p->keys[s] = r->keys[0];
+            }
+            else{
+                Inner* r{static_cast<Inner*>(p->children[s+1])};
+                Inner* c{static_cast<Inner*>(n)};
+                c->keys[c->n] = std::move(p->keys[s]);
+                c->children[c->n+1] = r->children[0];
+                ++c->n;
+                p->keys[s] = std::move(r->keys[0]);
+                std::move(r->keys+1,r->keys+r->n,r->keys);
+                std::move(r->children+1,r->children+r->n+1,r->children);
+                --r->n;
+            }
+            return;
+        }
+
+        // 3. merge with a sibling (both are at most half full): the right node
+        //    of the pair is emptied into the left one and unlinked from p
+        unsigned int ls{s>0? s-1 : s};
+        if(at_leaves){
+            Leaf* l{static_cast<Leaf*>(p->children[ls])};
+            Leaf* r{static_cast<Leaf*>(p->children[ls+1])};
+            std::move(r->keys,r->keys+r->n,l->keys+l->n);
+            std::move(r->values,r->values+r->n,l->values+l->n);
+            l->n += r->n;
+            l->next = r->next;
+            if(r->next){ r->next->prev = l;}
+            delete r;
+        }
+        else{
+            Inner* l{static_cast<Inner*>(p->children[ls])};
+            Inner* r{static_cast<Inner*>(p->children[ls+1])};
+            l->keys[l->n] = std::move(p->keys[ls]);
+            std::move(r->keys,r->keys+r->n,l->keys+l->n+1);
+            std::copy(r->children,r->children+r->n+1,l->children+l->n+1);
+            l->n += r->n+1;
+            delete r;
+        }
+        std::move(p->keys+ls+1,p->keys+p->n,p->keys+ls);
+        std::copy(p->children+ls+2,p->children+p->n+1,p->children+ls+1);
+        --p->n;
+
+        n = p;
+    }
+
+    // an empty inner root is replaced by its only child, an empty leaf root by nothing
+    while(levels>0 && root->n==0){
+        Inner* r{static_cast<Inner*>(root)};
+        root = r->children[0];
+        delete r;
+        --levels;
+    }
+    if(levels==0 && root->n==0){
+        delete static_cast<Leaf*>(root);
+        root = nullptr;
+        first = nullptr;
+    }
+}
@@ -0,0 +1,873 @@
+#pragma once
+
+#include <iostream>
+#include <exception>
+#include <stdexcept>    // for std::length_error
+#include <utility>      // for std::pair
+#include <functional>   // for std::less
+#include <cstdint>      // for std::uint32_t
+#include <vector>
+#include <iterator>     // for std::distance, std::make_move_iterator
+#include <algorithm>    // for std::stable_sort, std::max
+#include <string>
+#include <sstream>      // for std::stringstream
+
+#include "bst.hpp"      // for range_order, compare_keys
+
+
+/// @brief Binary search tree with a compact, index-based memory layout.
+///
+/// Same interface as Bst (see bst.hpp), different storage engine:
+/// nodes live in contiguous vectors and are linked by 32-bit indices instead
+/// of pointers, and data is split by access frequency:
+/// - hot:      key and child links, the only things a search touches
+/// - parents:  parent links, only needed to iterate and erase
+/// - values:   V, only touched once the key is found
+///
+/// For CompactBst<int,double> a node takes 24 bytes (vs. 48 bytes plus the
+/// allocator overhead of a Bst node) and a search reads 12 bytes per level.
+///
+/// Differences from Bst:
+/// - erase() fills the hole with the last node of the store, hence it
+///   invalidates iterators (as well as insertions that reallocate the store)
+/// - dereferencing an iterator gives a (key,value) pair of references by value,
+///   so range-for loops should use `auto` or `const auto&` instead of `auto&`
+/// - get_height() walks the tree (heights are not stored, to save room)
+/// - at most 2^32-1 nodes
+/// - only the core map interface (lookups, bounds, ranges, insert/emplace/operator[],
+///   erase, balance, printing): none of Bst's hinted insertions, try_emplace(),
+///   insert_or_assign(), node handles, order statistics, split/join or merges
+///
+/// @tparam K       Type of the keys used to order the nodes in the BST
+/// @tparam V       Type of the values stored in the nodes
+/// @tparam cmp     Comparator class (default: std::less<K>)
+template< class K, class V, class cmp = std::less<K> >
+class CompactBst{
+
+  public:
+    using kvpair = std::pair<const K,V>;
+
+  private:
+
+    using index = std::uint32_t;
+
+    /// @brief "null" link
+    static constexpr index nil{0xffffffff};
+
+    /// @brief Node data read by searches.
+    struct Hot{
+        K key;
+        index l_child;
+        index r_child;
+    };
+
+    std::vector<Hot> hot;       ///< keys and child links
+    std::vector<index> parents; ///< parent links
+    std::vector<V> values;      ///< values
+
+    index root{nil};
+
+    /// @brief Next index in cmp order (nil if none).
+    ///
+    /// @param n        current index
+    /// @return index   next index
+    index next_index(index n) const noexcept;
+
+    /// @brief Leftmost index of the subtree rooted at n (nil if empty).
+    index leftmost(index n) const noexcept{
+        if(n!=nil){
+            while(hot[n].l_child!=nil){ n = hot[n].l_child;}
+        }
+        return n;
+    }
+
+    /// @brief Base template iterator class.
+    ///
+    /// @tparam Tree    CompactBst or const CompactBst
+    /// @tparam KV      Type returned by dereference op (a pair of references)
+    template<class Tree, class KV>
+    class _iterator{
+
+        Tree* tree;     ///< tree the iterator walks
+        index current;  ///< current node index
+
+        friend class CompactBst;
+        template<class,class> friend class _iterator;
+
+      public:
+        _iterator(Tree* t, index n): tree(t), current(n){};
+
+        /// @brief Conversion from iterator to const_iterator.
+        ///
+        /// @param it iterator to convert
+        template<class Tree2, class KV2, class = typename std::enable_if<std::is_same<const Tree2,Tree>::value>::type>
+        _iterator(const _iterator<Tree2,KV2>& it): tree(it.tree), current(it.current){};
+
+        bool operator==(const _iterator& rhs) const{return current == rhs.current;}
+        bool operator!=(const _iterator& rhs) const{return !(current == rhs.current);}
+
+        /// @brief pre-increment.
+        _iterator& operator++(){
+            current = tree->next_index(current);
+            return *this;
+        }
+
+        /// @brief post-increment.
+        _iterator operator++(int){
+            _iterator cp{*this};
+            current = tree->next_index(current);
+            return cp;
+        }
+
+        /// @brief de-reference op.
+        ///
+        /// @return KV (key,value) references
+        KV operator*() const{
+            if(current==nil){
+                throw std::out_of_range("CompactBst iterator out of range!");
+            }
+            return KV{tree->hot[current].key, tree->values[current]};
+        }
+    };
+
+  public:
+
+    // ctors, dtors -----------------------------------------------------------
+    CompactBst() = default;
+
+    /// @brief Bulk-load ctor. Builds a balanced bst from a range of key/value pairs.
+    ///
+    /// @tparam It      forward iterator to std::pair<K,V> (or kvpair)
+    /// @param first    range begin
+    /// @param last     range end
+    /// @param order    how the range is ordered (default: sorted)
+    template< class It >
+    CompactBst(It first, It last, range_order order = range_order::sorted){
+        assign(first,last,order);
+    }
+
+    // copy/move semantics: the store is made of vectors, defaults do (deep copies are linear)
+
+    CompactBst(const CompactBst&) = default;
+    CompactBst(CompactBst&& bst) noexcept:
+            hot{std::move(bst.hot)}, parents{std::move(bst.parents)},
+            values{std::move(bst.values)}, root{bst.root}{
+        bst.clear();
+    }
+    CompactBst& operator=(const CompactBst&) = default;
+    CompactBst& operator=(CompactBst&& rhs) noexcept{
+        if(this != &rhs){
+            hot = std::move(rhs.hot);
+            parents = std::move(rhs.parents);
+            values = std::move(rhs.values);
+            root = rhs.root;
+            rhs.clear();
+        }
+        return *this;
+    }
+
+    // Iterator interface -----------------------------------------------------
+
+    typedef _iterator<CompactBst, std::pair<const K&,V&>> iterator;
+    typedef _iterator<const CompactBst, std::pair<const K&,const V&>> const_iterator;
+
+    inline iterator begin(){ return iterator{this,leftmost(root)};}
+    inline const_iterator begin() const{ return const_iterator{this,leftmost(root)};}
+    inline const_iterator cbegin() const{ return const_iterator{this,leftmost(root)};}
+
+    inline iterator end(){ return iterator{this,nil};}
+    inline const_iterator end() const{ return const_iterator{this,nil};}
+    inline const_iterator cend() const{ return const_iterator{this,nil};}
+
+    //---------------
+    // Node insertion
+    //---------------
+
+  private:
+
+    /// @brief Looks for key by descent from root.
+    ///
+    /// @tparam KT      K or any type cmp can compare with K (transparent cmp)
+    /// @param key      key to look for
+    /// @param parent   (out) if key is not found, node the new one should be linked to (nil: empty tree)
+    /// @param left     (out) if key is not found, whether it should be linked as left child
+    /// @return index   node holding key, nil if not found
+    template< class KT >
+    index find_position(const KT& key, index& parent, bool& left) const;
+
+    /// @brief Appends a new node to the store and links it where find_position() told.
+    ///
+    /// @param parent   node to link the new one to (nil: it becomes root)
+    /// @param left     whether the new node is the left child of parent
+    /// @param key      key of the new node
+    /// @param vargs    value to copy/move into the new node (none: V is value-initialised);
+    ///                 emplace() list-initialises it beforehand, as Bst::emplace() does
+    /// @return index   the new node
+    template< class KT, class... VArgs >
+    index create_node(index parent, bool left, KT&& key, VArgs&&... vargs);
+
+  public:
+
+    /// @brief Inserts a new node in the tree by moving given key/value pair.
+    ///
+    /// If given key is already used the tree is left unchanged.
+    ///
+    /// @param kv   key/value pair to move
+    /// @return std::pair<iterator, bool> iterator to element at given key + if insertion was successful
+    std::pair<iterator, bool> insert(kvpair&& kv);
+
+    /// @brief Inserts a new node in the tree by copying given key/value pair.
+    ///
+    /// If given key is already used the tree is left unchanged.
+    ///
+    /// @param kv   key/value pair to copy
+    /// @return std::pair<iterator, bool> iterator to element at given key + if insertion was successful
+    std::pair<iterator, bool> insert(const kvpair& kv){ return insert(kvpair{kv});}
+
+    /// @brief Inserts a new node in the tree by creating its value from given args.
+    ///
+    /// If given key is already used the tree is left unchanged (and the value is not built).
+    /// As in Bst, the value is list-initialised (V{vctorargs...}), then moved into the store.
+    ///
+    /// @tparam vctorargtypes   argument types of V ctor
+    /// @param key              key value to insert the element at (if not present)
+    /// @param vctorargs        values forwarded to V ctor
+    /// @return std::pair<iterator, bool> iterator to element at given key + if insertion was successful
+    template< class... vctorargtypes >
+    std::pair<iterator, bool> emplace(const K& key, vctorargtypes&&... vctorargs);
+
+    /// @brief Makes room for n nodes, so that the next insertions do not reallocate the store.
+    ///
+    /// @param n number of nodes
+    void reserve(unsigned int n){
+        hot.reserve(n);
+        parents.reserve(n);
+        values.reserve(n);
+    }
+
+    //----------
+    // Bulk load
+    //----------
+
+  private:
+
+    /// @brief Links the nodes of the store (supposedly in cmp order) into
+    ///        a balanced tree, the middle node of each range being the root of the range.
+    ///
+    /// @param lo       range begin
+    /// @param hi       range end
+    /// @param parent   parent of the range root
+    /// @return index   range root
+    index link_sorted_rec(index lo, index hi, index parent) noexcept;
+
+  public:
+
+    /// @brief Replaces the content of the tree with a balanced bst built from
+    ///        a range of key/value pairs. See Bst::assign().
+    ///
+    /// @tparam It      forward iterator to std::pair<K,V> (or kvpair)
+    /// @param first    range begin
+    /// @param last     range end
+    /// @param order    how the range is ordered (default: sorted)
+    template< class It >
+    void assign(It first, It last, range_order order = range_order::sorted);
+
+    //------------
+    // Node access
+    //------------
+
+  private:
+
+    // KT is K or, with a transparent cmp, any type cmp can compare with K
+
+    /// @brief Index of given key (nil if not found).
+    template< class KT >
+    index find_index(const KT& key) const;
+
+    /// @brief First index whose key is not less than key (nil if none).
+    template< class KT >
+    index lower_bound_index(const KT& key) const;
+
+    /// @brief First index whose key is greater than key (nil if none).
+    template< class KT >
+    index upper_bound_index(const KT& key) const;
+
+    /// @brief Lightweight view over the elements between two iterators,
+    ///        so that a range can be used in a range-for loop. See Bst::_range.
+    ///
+    /// @tparam It iterator or const_iterator
+    template<class It>
+    class _range{
+        It first;
+        It last;
+
+      public:
+        _range(It p_first, It p_last): first{p_first}, last{p_last}{};
+
+        It begin() const{ return first;}
+        It end() const{ return last;}
+
+        /// @brief Whether the view holds no elements.
+        bool empty() const{ return first==last;}
+    };
+
+  public:
+
+    typedef _range<iterator> range_type;
+    typedef _range<const_iterator> const_range_type;
+
+    // As in Bst, overloads taking a generic KT are only enabled when cmp
+    // declares is_transparent (e.g. std::less<>).
+
+    /// @brief returns an iterator to given key (or to end() if none was found).
+    inline iterator find(const K& key){ return iterator{this,find_index(key)};}
+    inline const_iterator find(const K& key) const{ return const_iterator{this,find_index(key)};}
+
+    /// @brief Heterogeneous find (transparent cmp only). See find(const K&).
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline iterator find(const KT& key){ return iterator{this,find_index(key)};}
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline const_iterator find(const KT& key) const{ return const_iterator{this,find_index(key)};}
+
+    /// @brief Whether given key is present.
+    inline bool contains(const K& key) const{ return find_index(key)!=nil;}
+
+    /// @brief Heterogeneous contains (transparent cmp only). See contains(const K&).
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline bool contains(const KT& key) const{ return find_index(key)!=nil;}
+
+    /// @brief Iterator to the first element whose key is not less than key.
+    inline iterator lower_bound(const K& key){ return iterator{this,lower_bound_index(key)};}
+    inline const_iterator lower_bound(const K& key) const{ return const_iterator{this,lower_bound_index(key)};}
+
+    /// @brief Heterogeneous lower_bound (transparent cmp only). See lower_bound(const K&).
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline iterator lower_bound(const KT& key){ return iterator{this,lower_bound_index(key)};}
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline const_iterator lower_bound(const KT& key) const{ return const_iterator{this,lower_bound_index(key)};}
+
+    /// @brief Iterator to the first element whose key is greater than key.
+    inline iterator upper_bound(const K& key){ return iterator{this,upper_bound_index(key)};}
+    inline const_iterator upper_bound(const K& key) const{ return const_iterator{this,upper_bound_index(key)};}
+
+    /// @brief Heterogeneous upper_bound (transparent cmp only). See upper_bound(const K&).
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline iterator upper_bound(const KT& key){ return iterator{this,upper_bound_index(key)};}
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    inline const_iterator upper_bound(const KT& key) const{ return const_iterator{this,upper_bound_index(key)};}
+
+    /// @brief Range of elements whose key is equivalent to key (at most one).
+    ///
+    /// @param key  key to look for
+    /// @return std::pair<iterator,iterator> lower_bound(key), upper_bound(key)
+    std::pair<iterator,iterator> equal_range(const K& key){
+        return std::make_pair(lower_bound(key),upper_bound(key));
+    }
+    std::pair<const_iterator,const_iterator> equal_range(const K& key) const{
+        return std::make_pair(lower_bound(key),upper_bound(key));
+    }
+
+    /// @brief View over the elements whose key lies in [lo,hi), to be used in
+    ///        range-for loops. Two O(height) descents, no copy.
+    ///
+    /// @param lo           lower bound (included)
+    /// @param hi           upper bound (excluded)
+    /// @return range_type  view over the elements (empty if !(lo<hi))
+    range_type range(const K& lo, const K& hi){
+        iterator first{lower_bound(lo)};
+        return range_type{first, cmp()(lo,hi)? lower_bound(hi) : first};
+    }
+    const_range_type range(const K& lo, const K& hi) const{
+        const_iterator first{lower_bound(lo)};
+        return const_range_type{first, cmp()(lo,hi)? lower_bound(hi) : first};
+    }
+
+    /// @brief returns a r/w reference to value at given key (eventually initializing it).
+    ///
+    /// @param key        key of the element to return
+    /// @return V&        reference to the element at key (initializes it if not present already)
+    V& operator[](const K& key);
+
+    /// @brief returns a r/w reference to value at given key (eventually initializing it).
+    ///
+    /// @param key        key of the element to return (moved only if inserted)
+    /// @return V&        reference to the element at key (initializes it if not present already)
+    V& operator[](K&& key);
+
+    //-------------
+    // Node removal
+    //-------------
+
+  private:
+
+    /// @brief Replaces the link from p to old with a link to c (p==nil: root).
+    void replace_child(index p, index old, index c) noexcept{
+        if(p==nil){ root = c;}
+        else if(hot[p].l_child==old){ hot[p].l_child = c;}
+        else{ hot[p].r_child = c;}
+    }
+
+    /// @brief Moves the last node of the store into slot n (whose node was unlinked)
+    ///        and shrinks the store by one, keeping it contiguous.
+    ///
+    /// @param n free slot
+    void move_last_into(index n);
+
+    /// @brief Unlinks node n (nil: nothing to do) and fills its slot. See erase().
+    void erase_index(index n);
+
+  public:
+
+    /// @brief Remove the element at given key (if present) while preserving bst structure.
+    ///        Invalidates iterators.
+    ///
+    /// @param key Key of the element to remove
+    void erase(const K& key){ erase_index(find_index(key));}
+
+    /// @brief Heterogeneous erase (transparent cmp only). See erase(const K&).
+    template< class KT, class C = cmp, class = typename C::is_transparent >
+    void erase(const KT& key){ erase_index(find_index(key));}
+
+    /// @brief Clears the content of the tree and gives its memory back.
+    void clear() noexcept{
+        std::vector<Hot>().swap(hot);
+        std::vector<index>().swap(parents);
+        std::vector<V>().swap(values);
+        root = nil;
+    }
+
+    //-------
+    // Output
+    //-------
+
+    /// @brief Getter for bst size.
+    ///
+    /// @return unsigned int bst's size
+    unsigned int get_size() const noexcept{return static_cast<unsigned int>(hot.size());}
+
+    /// @brief Getter for bst height. O(N): heights are not stored (the tree is walked
+    ///        through parent links, no recursion).
+    ///
+    /// @return int tree's height (-1 if empty)
+    int get_height() const noexcept;
+
+    /// @brief Sends string representation of bst to ostream.
+    ///
+    /// @param os               output stream
+    /// @param bst              current object
+    /// @return std::ostream&   the ostream, to allow chained call
+    friend
+    std::ostream& operator<< (std::ostream& os, const CompactBst& bst){
+        os<<"size:"<<bst.get_size()<<" height:"<<bst.get_height()<<"\n";
+        for (const auto& kv:bst){
+            os<<"("<<kv.first<<","<<kv.second<<") ";
+        }
+        return os;
+    }
+
+    /// @brief Writes a graphical representation of the bst onto the given std::ostream.
+    ///        Same layout as Bst::pretty_print().
+    ///
+    /// @param os       Output stream (default: std::cout)
+    /// @param empty    Character to replace empty nodes (default: '.')
+    void pretty_print(std::ostream &os = std::cout, std::string empty=".") const;
+
+    //--------
+    // Balance
+    //--------
+
+    /// @brief Balances the tree. Nodes are laid out again in cmp order
+    ///        (so that iteration scans the store sequentially), then relinked
+    ///        into a tree whose levels are all full except (maybe) the last one.
+    ///        O(N) time, O(N) transient memory. Invalidates iterators.
+    void balance();
+};
+
+
+//#############################################################################
+//DEFINITIONS
+//#############################################################################
+
+template< class K, class V, class cmp >
+constexpr typename CompactBst<K,V,cmp>::index CompactBst<K,V,cmp>::nil;
+
+template< class K, class V, class cmp >
+typename CompactBst<K,V,cmp>::index CompactBst<K,V,cmp>::next_index(index n) const noexcept{
+    if(n==nil){
+        return nil;
+    }
+
+    // 1. leftmost of r_child subtree
+    if(hot[n].r_child!=nil){
+        return leftmost(hot[n].r_child);
+    }
+
+    // 2. first ancestor whose l_child is ancestor
+    index p{parents[n]};
+    while(p!=nil && n==hot[p].r_child){
+        n = p;
+        p = parents[p];
+    }
+    return p;
+}
+
+// insertion
+
+template< class K, class V, class cmp >
+template< class KT >
+typename CompactBst<K,V,cmp>::index CompactBst<K,V,cmp>::find_position(const KT& key, index& parent, bool& left) const{
+    index target{root};
+    parent = nil;
+    left = false;
+    while(target!=nil){
+        const Hot& h{hot[target]};
+        int c{compare_keys<cmp>(key,h.key)};
+        //=
+        if(c==0){ return target;}
+        parent = target;
+        left = c<0;
+        target = left? h.l_child : h.r_child;
+    }
+    return nil;
+}
+
+template< class K, class V, class cmp >
+template< class KT, class... VArgs >
+typename CompactBst<K,V,cmp>::index CompactBst<K,V,cmp>::create_node(index parent, bool left, KT&& key, VArgs&&... vargs){
+    if(hot.size()>=nil){
+        throw std::length_error("CompactBst: too many nodes!");
+    }
+    index n{static_cast<index>(hot.size())};
+
+    // the three stores grow together: roll back if any of them throws
+    values.emplace_back(std::forward<VArgs>(vargs)...);
+    try{
+        hot.push_back(Hot{std::forward<KT>(key),nil,nil});
+    }
+    catch(...){
+        values.pop_back();
+        throw;
+    }
+    try{
+        parents.push_back(parent);
+    }
+    catch(...){
+        hot.pop_back();
+        values.pop_back();
+        throw;
+    }
+
+    if(parent==nil){ root = n;}
+    else if(left){ hot[parent].l_child = n;}
+    else{ hot[parent].r_child = n;}
+    return n;
+}
+
+template< class K, class V, class cmp >
+std::pair<typename CompactBst<K,V,cmp>::iterator, bool> CompactBst<K,V,cmp>::insert(kvpair&& kv){
+    index parent;
+    bool left;
+    index target{find_position(kv.first,parent,left)};
+
+    //=
+    if(target!=nil){
+        return std::make_pair(iterator{this,target},false);
+    }
+
+    target = create_node(parent,left,kv.first,std::move(kv.second));
+    return std::make_pair(iterator{this,target},true);
+}
+
+template< class K, class V, class cmp >
+template< class... vctorargtypes >
+std::pair<typename CompactBst<K,V,cmp>::iterator, bool> CompactBst<K,V,cmp>::emplace(const K& key, vctorargtypes&&... vctorargs){
+    index parent;
+    bool left;
+    index target{find_position(key,parent,left)};
+
+    //=
+    if(target!=nil){
+        return std::make_pair(iterator{this,target},false);
+    }
+
+    target = create_node(parent,left,key,V{std::forward<vctorargtypes>(vctorargs)...});
+    return std::make_pair(iterator{this,target},true);
+}
+
+// Bulk load
+
+template< class K, class V, class cmp >
+typename CompactBst<K,V,cmp>::index CompactBst<K,V,cmp>::link_sorted_rec(index lo, index hi, index parent) noexcept{
+    if(lo==hi){
+        return nil;
+    }
+    index m{lo+(hi-lo)/2};
+    parents[m] = parent;
+    hot[m].l_child = link_sorted_rec(lo,m,m);
+    hot[m].r_child = link_sorted_rec(m+1,hi,m);
+    return m;
+}
+
+template< class K, class V, class cmp >
+template< class It >
+void CompactBst<K,V,cmp>::assign(It first, It last, range_order order){
+
+    // unsorted: sort a copy, then load it as a sorted range
+    if(order==range_order::unsorted){
+        std::vector<std::pair<K,V>> buf(first,last);
+        std::stable_sort(buf.begin(),buf.end(),
+            [](const std::pair<K,V>& a, const std::pair<K,V>& b){ return cmp()(a.first,b.first);});
+        assign(std::make_move_iterator(buf.begin()),std::make_move_iterator(buf.end()),range_order::sorted);
+        return;
+    }
+
+    clear();
+    std::size_t n{static_cast<std::size_t>(std::distance(first,last))};
+    if(n>=nil){
+        throw std::length_error("CompactBst: too many nodes!");
+    }
+    hot.reserve(n);
+    values.reserve(n);
+
+    // lay the (distinct) pairs out in order...
+    bool dedup{order==range_order::sorted};
+    for(; first!=last; ++first){
+        if(dedup && !hot.empty() && !cmp()(hot.back().key,(*first).first)){ continue;}
+        hot.push_back(Hot{(*first).first,nil,nil});
+        values.push_back((*first).second);
+    }
+    parents.resize(hot.size());
+
+    // ... and link them
+    root = link_sorted_rec(0,static_cast<index>(hot.size()),nil);
+}
+
+// Node access
+
+template< class K, class V, class cmp >
+template< class KT >
+typename CompactBst<K,V,cmp>::index CompactBst<K,V,cmp>::find_index(const KT& key) const{
+    index target{root};
+    while(target!=nil){
+        const Hot& h{hot[target]};
+        int c{compare_keys<cmp>(key,h.key)};
+        if(c==0){ break;}
+        target = c<0? h.l_child : h.r_child;
+    }
+    return target;
+}
+
+template< class K, class V, class cmp >
+template< class KT >
+typename CompactBst<K,V,cmp>::index CompactBst<K,V,cmp>::lower_bound_index(const KT& key) const{
+    index target{root}, bound{nil};
+    while(target!=nil){
+        // target >= key: candidate, look for a smaller one on the left
+        if(!cmp()(hot[target].key,key)){
+            bound = target;
+            target = hot[target].l_child;
+        }
+        else{
+            target = hot[target].r_child;
+        }
+    }
+    return bound;
+}
+
+template< class K, class V, class cmp >
+template< class KT >
+typename CompactBst<K,V,cmp>::index CompactBst<K,V,cmp>::upper_bound_index(const KT& key) const{
+    index target{root}, bound{nil};
+    while(target!=nil){
+        // target > key: candidate, look for a smaller one on the left
+        if(cmp()(key,hot[target].key)){
+            bound = target;
+            target = hot[target].l_child;
+        }
+        else{
+            target = hot[target].r_child;
+        }
+    }
+    return bound;
+}
+
+template< class K, class V, class cmp >
+V& CompactBst<K,V,cmp>::operator[](const K& key){
+    index parent;
+    bool left;
+    index target{find_position(key,parent,left)};
+    if(target==nil){
+        target = create_node(parent,left,key);
+    }
+    return values[target];
+}
+
+template< class K, class V, class cmp >
+V& CompactBst<K,V,cmp>::operator[](K&& key){
+    index parent;
+    bool left;
+    index target{find_position(key,parent,left)};
+    if(target==nil){
+        target = create_node(parent,left,std::move(key));
+    }
+    return values[target];
+}
+
+// Node removal
+
+template< class K, class V, class cmp >
+void CompactBst<K,V,cmp>::move_last_into(index n){
+    index last{static_cast<index>(hot.size()-1)};
+    if(n!=last){
+        hot[n] = std::move(hot[last]);
+        values[n] = std::move(values[last]);
+        parents[n] = parents[last];
+
+        // family of the moved node now points at n
+        replace_child(parents[n],last,n);
+        if(hot[n].l_child!=nil){ parents[hot[n].l_child] = n;}
+        if(hot[n].r_child!=nil){ parents[hot[n].r_child] = n;}
+    }
+    hot.pop_back();
+    parents.pop_back();
+    values.pop_back();
+}
+
+template< class K, class V, class cmp >
+void CompactBst<K,V,cmp>::erase_index(index n){
+    // key not present. Skip
+    if(n==nil){
+        return;
+    }
+
+    index p{parents[n]}, l{hot[n].l_child}, r{hot[n].r_child};
+
+    // both children: the successor is unlinked and relinked in n's place
+    if(l!=nil && r!=nil){
+        index s{leftmost(r)};
+        if(s!=r){
+            // successor's right subtree takes its place below its parent...
+            index sp{parents[s]};
+            hot[sp].l_child = hot[s].r_child;
+            if(hot[s].r_child!=nil){ parents[hot[s].r_child] = sp;}
+
+            // ... while successor adopts n's right subtree
+            hot[s].r_child = r;
+            parents[r] = s;
+        }
+        hot[s].l_child = l;
+        parents[l] = s;
+        parents[s] = p;
+        replace_child(p,n,s);
+    }
+    // at most one child: link parent and child
+    else{
+        index c{l!=nil? l : r};
+        if(c!=nil){ parents[c] = p;}
+        replace_child(p,n,c);
+    }
+
+    move_last_into(n);
+}
+
+// Output
+
+template< class K, class V, class cmp >
+int CompactBst<K,V,cmp>::get_height() const noexcept{
+    int height{-1}, depth{0};
+    index n{root}, prev{nil};
+    while(n!=nil){
+        // coming from parent: go down left, or right, if possible
+        if(prev==parents[n]){
+            if(depth>height){ height = depth;}
+            prev = n;
+            if(hot[n].l_child!=nil){ n = hot[n].l_child; ++depth; continue;}
+            if(hot[n].r_child!=nil){ n = hot[n].r_child; ++depth; continue;}
+        }
+        // coming from left child: go down right, if possible
+        else if(prev==hot[n].l_child){
+            prev = n;
+            if(hot[n].r_child!=nil){ n = hot[n].r_child; ++depth; continue;}
+        }
+        else{
+            prev = n;
+        }
+
+        // both children done: go up
+        n = parents[n];
+        --depth;
+    }
+    return height;
+}
+
+template< class K, class V, class cmp >
+void CompactBst<K,V,cmp>::pretty_print(std::ostream &os, std::string empty) const{
+
+    // start with a newline
+    os<<std::endl;
+
+    // "[key]:[value]" representation of a node (empty for nil)
+    auto node_to_str = [&](index n){
+        if(n==nil){ return empty;}
+        std::stringstream ss;
+        ss<<hot[n].key<<":"<<values[n];
+        return ss.str();
+    };
+
+    int height{get_height()};
+
+    // single|no node case: just print root
+    if(height<1){
+        os<<node_to_str(root)<<std::endl;
+        return;
+    }
+
+    // greatest representation size among tree nodes, plus 2 (to separate nodes),
+    // times the number of nodes of the bottom layer: see Bst::pretty_print()
+    std::size_t nrep_size{0};
+    for(index n{0}; n<hot.size(); ++n){
+        nrep_size = std::max(nrep_size,node_to_str(n).length());
+    }
+    nrep_size = (nrep_size+2)<<height;
+
+    // nodes at current depth, left to right (nil for missing ones)
+    std::vector<index> layer{root};
+    for(int depth{0}; depth<=height; ++depth){
+        for(index n: layer){
+            auto noderep{node_to_str(n)};
+            os<<centered(noderep,nrep_size);
+        }
+        os<<std::endl<<std::endl;
+
+        // halve nrep_size
+        nrep_size/=2;
+
+        std::vector<index> next;
+        next.reserve(2*layer.size());
+        for(index n: layer){
+            next.push_back(n==nil? nil : hot[n].l_child);
+            next.push_back(n==nil? nil : hot[n].r_child);
+        }
+        layer.swap(next);
+    }
+}
+
+// Balance
+
+template< class K, class V, class cmp >
+void CompactBst<K,V,cmp>::balance(){
+    // lay the nodes out in cmp order...
+    std::vector<Hot> sorted_hot;
+    std::vector<V> sorted_values;
+    sorted_hot.reserve(hot.size());
+    sorted_values.reserve(values.size());
+    for(index n{leftmost(root)}; n!=nil; n=next_index(n)){
+        sorted_hot.push_back(std::move(hot[n]));
+        sorted_values.push_back(std::move(values[n]));
+    }
+    hot.swap(sorted_hot);
+    values.swap(sorted_values);
+
+    // ... and link them
+    root = link_sorted_rec(0,static_cast<index>(hot.size()),nil);
+}
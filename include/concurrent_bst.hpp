@@ -0,0 +1,334 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>      // for std::size_t
+#include <cstring>      // for std::memcpy
+#include <mutex>        // for std::unique_lock
+#include <shared_mutex> // for std::shared_timed_mutex, std::shared_lock
+#include <type_traits>  // for std::is_trivially_copyable, std::aligned_storage
+#include <utility>      // for std::forward
+#include <functional>   // for std::less
+
+#include "bst.hpp"
+
+// Readers always take the shared lock where relaxed loads (__atomic_load_n) are not
+// available, and under ThreadSanitizer, which would flag the writers' plain stores
+// racing with them
+#if !defined(__GNUC__) || defined(__SANITIZE_THREAD__)
+#define CONCURRENT_BST_LOCKED_READS
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define CONCURRENT_BST_LOCKED_READS
+#endif
+#endif
+
+
+/// @brief Bst wrapper for many concurrent readers and (a few) writers.
+///
+/// Writers (insert(), emplace(), erase()...) take an exclusive lock and mutate the
+/// tree in place. Readers (find(), contains(), operator[] on present keys) take no lock
+/// at all: they validate their descent against a sequence counter (seqlock) that
+/// writers make odd while at work. A reader that overlapped a writer just tries again,
+/// and after a few failed attempts falls back to a shared lock.
+///
+/// Readers may thus look at nodes a writer is changing, or has just erased. That is
+/// only allowed when it cannot go wrong:
+/// - K and V are trivially copyable (a torn key or value is never dereferenced, and
+///   values are handed out as copies validated after the fact)
+/// - nodes come from an allocator keeping freed memory until release() (arena_allocator):
+///   erased nodes stay readable, recycled ones keep pointing to nodes or to nothing
+/// - cmp does not care about the bit pattern it is given
+/// Otherwise every read takes the shared lock (readers still run in parallel).
+/// Readers also recheck the counter at every level, so that they stop following links
+/// as soon as a writer starts (a tree halfway through a rotation may even have loops).
+///
+/// Optimistic readers load node links, keys and values a writer may be storing to
+/// (relinking, rotating, or the arena reusing freed nodes): every such load is a relaxed
+/// atomic one (__atomic_load_n; keys and values that do not fit a naturally aligned word
+/// are read a byte at a time), which the compiler may neither tear nor repeat, and results
+/// are only used once the counter proves no writer overlapped. Writers keep storing with plain writes: Bst nodes are plain
+/// structs, shared with every single threaded tree, and making them atomic would tax those.
+/// ThreadSanitizer cannot tell such a seqlock from a bug and would report those stores,
+/// so TSan builds (and compilers without __atomic builtins) always take the shared lock.
+///
+/// Lookups return copies: references into the tree would not survive the next writer.
+///
+/// @tparam K       Type of the keys
+/// @tparam V       Type of the values
+/// @tparam cmp     Comparator class (default: std::less<K>)
+/// @tparam Alloc   Node allocation policy (default: arena_allocator, see above)
+/// @tparam Balance Balancing policy (default: avl, keeping descents short)
+template< class K, class V, class cmp = std::less<K>, template<class> class Alloc = arena_allocator, class Balance = avl >
+class ConcurrentBst{
+
+  public:
+    using kvpair = std::pair<const K,V>;
+    using tree_type = Bst<K,V,cmp,Alloc,Balance>;
+
+  private:
+    using Node = typename tree_type::Node;
+
+    tree_type tree;
+    mutable std::shared_timed_mutex mtx;    ///< exclusive for writers, shared for readers falling back
+    std::atomic<unsigned int> seq{0};       ///< bumped by writers before and after their changes (odd: writer at work)
+
+    /// @brief Whether readers may go optimistic (see above).
+    static constexpr bool optimistic{std::is_trivially_copyable<K>::value
+                                     && std::is_trivially_copyable<V>::value
+                                     && Alloc<Node>::bulk_release
+#if defined(CONCURRENT_BST_LOCKED_READS)
+                                     && false
+#endif
+                                     };
+
+    /// @brief Optimistic reads tried before taking the shared lock.
+    static constexpr int optimistic_attempts{4};
+
+    /// @brief Copies obj, which a writer may be changing, into out with relaxed atomic
+    ///        loads: a single one if T fits a naturally aligned word, a byte at a time otherwise.
+    ///
+    /// @param obj  object to read (trivially copyable)
+    /// @param out  storage for sizeof(T) bytes, aligned as T
+    template<class T>
+    static void relaxed_copy(const T& obj, void* out) noexcept{
+        relaxed_copy(obj,out,std::integral_constant<bool,(sizeof(T)==1 || sizeof(T)==2 || sizeof(T)==4 || sizeof(T)==8)
+                                                         && alignof(T)==sizeof(T)>{});
+    }
+
+    template<class T>
+    static void relaxed_copy(const T& obj, void* out, std::true_type) noexcept{
+        __atomic_load(&obj,static_cast<T*>(out),__ATOMIC_RELAXED);
+    }
+
+    template<class T>
+    static void relaxed_copy(const T& obj, void* out, std::false_type) noexcept{
+        const unsigned char* src{reinterpret_cast<const unsigned char*>(&obj)};
+        unsigned char* dst{static_cast<unsigned char*>(out)};
+        for(std::size_t iii{0}; iii<sizeof(T); ++iii){
+            dst[iii] = __atomic_load_n(src+iii,__ATOMIC_RELAXED);
+        }
+    }
+
+    /// @brief Relaxed atomic load of a link a writer may be changing.
+    static const Node* relaxed_link(Node* const& link) noexcept{
+        return __atomic_load_n(&link,__ATOMIC_RELAXED);
+    }
+
+    /// @brief Exclusive lock making the sequence counter odd while held.
+    class write_section{
+
+        ConcurrentBst& cb;
+        std::unique_lock<std::shared_timed_mutex> lock;
+
+      public:
+        explicit write_section(ConcurrentBst& c): cb(c), lock(c.mtx){
+            cb.seq.store(cb.seq.load(std::memory_order_relaxed)+1,std::memory_order_relaxed);
+            // the counter turns odd before any change can be seen
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        ~write_section(){
+            cb.seq.store(cb.seq.load(std::memory_order_relaxed)+1,std::memory_order_release);
+        }
+    };
+
+    /// @brief Lock-free lookup validated by the sequence counter.
+    ///
+    /// @param key      key to look for
+    /// @param found    (out) whether key is present
+    /// @param value    (out, may be null) storage for sizeof(V) bytes, gets those of the value at key, if found
+    /// @return bool    whether the lookup was consistent (if not, nothing can be told)
+    bool optimistic_find(const K& key, bool& found, void* value) const noexcept;
+
+  public:
+
+    ConcurrentBst() = default;
+
+    // the lock cannot be copied, nor moved
+    ConcurrentBst(const ConcurrentBst&) = delete;
+    ConcurrentBst& operator=(const ConcurrentBst&) = delete;
+
+    //--------
+    // Readers
+    //--------
+
+    /// @brief Looks for key and copies the value stored there.
+    ///
+    /// @param key      key to look for
+    /// @param value    (out) copy of the value at key, untouched if not found
+    /// @return bool    whether key was found
+    bool find(const K& key, V& value) const;
+
+    /// @brief Whether given key is present.
+    bool contains(const K& key) const;
+
+    /// @brief Returns a copy of the value at given key, inserting a default one
+    ///        (under the exclusive lock) if key is not present.
+    ///
+    /// @param key      key of the element to return
+    /// @return V       copy of the value at key
+    V operator[](const K& key);
+
+    /// @brief Getter for the number of elements.
+    unsigned int get_size() const{
+        std::shared_lock<std::shared_timed_mutex> lock{mtx};
+        return tree.get_size();
+    }
+
+    //--------
+    // Writers
+    //--------
+
+    /// @brief Inserts a copy of given pair (the tree is unchanged if key is present).
+    ///
+    /// @return bool whether the pair was inserted
+    bool insert(const kvpair& kv){
+        write_section w{*this};
+        return tree.insert(kvpair{kv}).second;
+    }
+
+    /// @brief Inserts given pair by moving it (the tree is unchanged if key is present).
+    ///
+    /// @return bool whether the pair was inserted
+    bool insert(kvpair&& kv){
+        write_section w{*this};
+        return tree.insert(std::move(kv)).second;
+    }
+
+    /// @brief Inserts an element whose value is built from given args
+    ///        (the tree is unchanged if key is present).
+    ///
+    /// @return bool whether the element was inserted
+    template< class... vctorargtypes >
+    bool emplace(const K& key, vctorargtypes&&... vctorargs){
+        write_section w{*this};
+        return tree.emplace(key,std::forward<vctorargtypes>(vctorargs)...).second;
+    }
+
+    /// @brief Stores value at key, replacing the previous one if key is present.
+    void insert_or_assign(const K& key, const V& value){
+        write_section w{*this};
+        tree[key] = value;
+    }
+
+    /// @brief Removes the element at given key (if present).
+    void erase(const K& key){
+        write_section w{*this};
+        tree.erase(key);
+    }
+
+    /// @brief Removes every element.
+    ///        With optimistic readers around, nodes are erased one by one and their memory
+    ///        is kept for later insertions: it is only given back when the wrapper dies.
+    void clear();
+
+    /// @brief Balances the tree (see Bst::balance()).
+    void balance(){
+        write_section w{*this};
+        tree.balance();
+    }
+};
+
+
+//#############################################################################
+//DEFINITIONS
+//#############################################################################
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+constexpr bool ConcurrentBst<K,V,cmp,Alloc,Balance>::optimistic;
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+bool ConcurrentBst<K,V,cmp,Alloc,Balance>::optimistic_find(const K& key, bool& found, void* value) const noexcept{
+    for(int attempt{0}; attempt<optimistic_attempts; ++attempt){
+        unsigned int s{seq.load(std::memory_order_acquire)};
+        if(s&1){
+            continue;
+        }
+
+        const Node* target{relaxed_link(tree.root)};
+        bool torn{false};
+        while(target){
+            // the key is compared on a copy: K is trivially copyable here
+            typename std::aligned_storage<sizeof(K),alignof(K)>::type node_key;
+            relaxed_copy(target->kv.first,&node_key);
+            int c{compare_keys<cmp>(key,*reinterpret_cast<const K*>(&node_key))};
+            if(c==0){ break;}
+            target = relaxed_link(c<0? target->l_child : target->r_child);
+
+            // a writer started: stop before following links it may be changing
+            if(seq.load(std::memory_order_relaxed)!=s){
+                torn = true;
+                break;
+            }
+        }
+        if(torn){
+            continue;
+        }
+
+        found = target!=nullptr;
+        if(found && value){ relaxed_copy(target->kv.second,value);}
+
+        // every read above happens before the counter is checked again
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(seq.load(std::memory_order_relaxed)==s){
+            return true;
+        }
+    }
+    return false;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+bool ConcurrentBst<K,V,cmp,Alloc,Balance>::find(const K& key, V& value) const{
+    bool found{false};
+    if(optimistic){
+        // raw bytes (V is trivially copyable there): no default ctor needed,
+        // and value only gets them once the read is validated
+        typename std::aligned_storage<sizeof(V),alignof(V)>::type copy;
+        if(optimistic_find(key,found,&copy)){
+            if(found){ std::memcpy(static_cast<void*>(&value),&copy,sizeof(V));}
+            return found;
+        }
+    }
+
+    std::shared_lock<std::shared_timed_mutex> lock{mtx};
+    auto it{tree.find(key)};
+    found = it!=tree.cend();
+    if(found){ value = (*it).second;}
+    return found;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+bool ConcurrentBst<K,V,cmp,Alloc,Balance>::contains(const K& key) const{
+    bool found{false};
+    if(optimistic && optimistic_find(key,found,nullptr)){
+        return found;
+    }
+
+    std::shared_lock<std::shared_timed_mutex> lock{mtx};
+    return tree.contains(key);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+V ConcurrentBst<K,V,cmp,Alloc,Balance>::operator[](const K& key){
+    V value{};
+    if(find(key,value)){
+        return value;
+    }
+
+    // not there (yet): insert it
+    write_section w{*this};
+    return tree[key];
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+void ConcurrentBst<K,V,cmp,Alloc,Balance>::clear(){
+    write_section w{*this};
+    if(!optimistic){
+        tree.clear();
+        return;
+    }
+    while(tree.get_size()>0){
+        K key{(*tree.cbegin()).first};
+        tree.erase(key);
+    }
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <iostream>
+#include <exception>
+#include <stdexcept>    // for std::out_of_range
+#include <utility>      // for std::pair
+#include <functional>   // for std::less
+#include <cstddef>      // for std::size_t
+#include <vector>
+
+
+/// @brief Immutable, read-only snapshot of a bst (see Bst::freeze()).
+///
+/// Keys are stored in a flat array in Eytzinger (BFS) order: the root first,
+/// then its children, then its grandchildren... so that the children of the
+/// node at (1-based) position k sit at 2k and 2k+1. Searches need no links,
+/// walk down with a branch-free loop (the next position is computed from
+/// the comparison result instead of jumped to) and prefetch the cache line holding
+/// the nodes four levels below, so that memory latency overlaps the descent.
+/// Values live in a separate array with the same layout and are only touched once
+/// the key is found.
+///
+/// Iteration follows cmp order, as for Bst. Iterators dereference to a
+/// (key,value) pair of const references returned by value.
+///
+/// @tparam K       Type of the keys
+/// @tparam V       Type of the values
+/// @tparam cmp     Comparator class (default: std::less<K>)
+template< class K, class V, class cmp = std::less<K> >
+class FrozenBst{
+
+    std::vector<K> keys;    ///< keys in Eytzinger order (position k is stored at keys[k-1])
+    std::vector<V> values;  ///< values, same layout as keys
+
+    /// @brief Records the in-order rank of every position of the implicit tree
+    ///        rooted at k (ranks are handed out in order through next_rank).
+    ///
+    /// @param ranks        (out) ranks[k-1] is the in-order rank of position k
+    /// @param k            subtree root position (1-based)
+    /// @param next_rank    next rank to hand out
+    void fill_ranks(std::vector<std::size_t>& ranks, std::size_t k, std::size_t& next_rank) const noexcept;
+
+    /// @brief Branch-free descent: position of the first key not less than key.
+    ///
+    /// @param key          bound
+    /// @return std::size_t 1-based position (0 if every key is < key)
+    std::size_t lower_bound_pos(const K& key) const noexcept;
+
+    /// @brief Next position in cmp order (0 if none).
+    ///
+    /// @param k            current position
+    /// @return std::size_t next position
+    std::size_t next_pos(std::size_t k) const noexcept;
+
+    /// @brief Leftmost position of the subtree rooted at k (0 if empty).
+    std::size_t leftmost_pos(std::size_t k) const noexcept{
+        if(k>keys.size()){ return 0;}
+        while(2*k<=keys.size()){ k = 2*k;}
+        return k;
+    }
+
+  public:
+
+    /// @brief Sorted (cmp order) read-only iterator.
+    class const_iterator{
+
+        const FrozenBst* tree;  ///< snapshot the iterator walks
+        std::size_t current;    ///< current position (0: end)
+
+      public:
+        const_iterator(const FrozenBst* t, std::size_t k): tree(t), current(k){};
+
+        bool operator==(const const_iterator& rhs) const{return current == rhs.current;}
+        bool operator!=(const const_iterator& rhs) const{return !(current == rhs.current);}
+
+        /// @brief pre-increment.
+        const_iterator& operator++(){
+            current = tree->next_pos(current);
+            return *this;
+        }
+
+        /// @brief post-increment.
+        const_iterator operator++(int){
+            const_iterator cp{*this};
+            current = tree->next_pos(current);
+            return cp;
+        }
+
+        /// @brief de-reference op.
+        ///
+        /// @return std::pair<const K&,const V&> (key,value) references
+        std::pair<const K&,const V&> operator*() const{
+            if(current==0){
+                throw std::out_of_range("FrozenBst iterator out of range!");
+            }
+            return std::pair<const K&,const V&>{tree->keys[current-1], tree->values[current-1]};
+        }
+    };
+
+    typedef const_iterator iterator;
+
+    // ctors ------------------------------------------------------------------
+    FrozenBst() = default;
+
+    /// @brief Builds the snapshot from a range of key/value pairs in strictly
+    ///        increasing key order (e.g. a bst traversal). O(N).
+    ///
+    /// @tparam It      forward iterator to (key,value) pairs
+    /// @param first    range begin
+    /// @param last     range end
+    template< class It >
+    FrozenBst(It first, It last);
+
+    // Iterator interface -----------------------------------------------------
+
+    inline const_iterator begin() const{ return const_iterator{this,leftmost_pos(1)};}
+    inline const_iterator cbegin() const{ return const_iterator{this,leftmost_pos(1)};}
+
+    inline const_iterator end() const{ return const_iterator{this,0};}
+    inline const_iterator cend() const{ return const_iterator{this,0};}
+
+    // Node access ------------------------------------------------------------
+
+    /// @brief returns an iterator to the first element whose key is not less than key.
+    ///
+    /// @param key              bound
+    /// @return const_iterator  iterator to the element found (or end())
+    inline const_iterator lower_bound(const K& key) const{ return const_iterator{this,lower_bound_pos(key)};}
+
+    /// @brief returns an iterator to given key (or to end() if none was found).
+    ///
+    /// @param key              key to find
+    /// @return const_iterator  iterator to value found (or end() if key is not present)
+    const_iterator find(const K& key) const{
+        std::size_t k{lower_bound_pos(key)};
+        return const_iterator{this, (k!=0 && !cmp()(key,keys[k-1]))? k : 0};
+    }
+
+    /// @brief Whether given key is present.
+    inline bool contains(const K& key) const{ return find(key)!=cend();}
+
+    /// @brief returns a read-only reference to value at given key.
+    ///
+    /// @param key          key of the element to return
+    /// @return const V&    reference to the element at key (throws std::out_of_range if not present)
+    const V& at(const K& key) const{
+        std::size_t k{lower_bound_pos(key)};
+        if(k==0 || cmp()(key,keys[k-1])){
+            throw std::out_of_range("FrozenBst::at(): key not found!");
+        }
+        return values[k-1];
+    }
+
+    // Output -----------------------------------------------------------------
+
+    /// @brief Getter for snapshot size.
+    ///
+    /// @return std::size_t number of elements
+    std::size_t get_size() const noexcept{return keys.size();}
+
+    /// @brief Sends string representation of the snapshot to ostream.
+    ///
+    /// @param os               output stream
+    /// @param bst              current object
+    /// @return std::ostream&   the ostream, to allow chained call
+    friend
+    std::ostream& operator<< (std::ostream& os, const FrozenBst& bst){
+        os<<"size:"<<bst.get_size()<<" (frozen)\n";
+        for (const auto& kv:bst){
+            os<<"("<<kv.first<<","<<kv.second<<") ";
+        }
+        return os;
+    }
+};
+
+
+//#############################################################################
+//DEFINITIONS
+//#############################################################################
+
+template< class K, class V, class cmp >
+template< class It >
+FrozenBst<K,V,cmp>::FrozenBst(It first, It last){
+
+    // remember where each pair is...
+    std::vector<It> sorted;
+    for(; first!=last; ++first){
+        sorted.push_back(first);
+    }
+
+    // ... find out which one goes to each position...
+    std::vector<std::size_t> ranks(sorted.size());
+    std::size_t next_rank{0};
+    fill_ranks(ranks,1,next_rank);
+
+    // ... and lay them out
+    keys.reserve(sorted.size());
+    values.reserve(sorted.size());
+    for(std::size_t r: ranks){
+        auto&& kv = *sorted[r];
+        keys.push_back(kv.first);
+        values.push_back(kv.second);
+    }
+}
+
+template< class K, class V, class cmp >
+void FrozenBst<K,V,cmp>::fill_ranks(std::vector<std::size_t>& ranks, std::size_t k, std::size_t& next_rank) const noexcept{
+    // recursion depth is the (logarithmic) height of the implicit tree
+    if(k>ranks.size()){
+        return;
+    }
+    fill_ranks(ranks,2*k,next_rank);
+    ranks[k-1] = next_rank++;
+    fill_ranks(ranks,2*k+1,next_rank);
+}
+
+template< class K, class V, class cmp >
+std::size_t FrozenBst<K,V,cmp>::lower_bound_pos(const K& key) const noexcept{
+    const std::size_t n{keys.size()};
+    const K* data{keys.data()};
+
+    std::size_t k{1};
+    while(k<=n){
+#if defined(__GNUC__)
+        // the 16 descendants four levels below are contiguous: fetch them ahead
+        std::size_t ahead{16*k};
+        __builtin_prefetch(data + (ahead<=n? ahead-1 : 0));
+#endif
+        // go right (2k+1) if the key at k is smaller, left (2k) otherwise
+        k = 2*k + static_cast<std::size_t>(cmp()(data[k-1],key));
+    }
+
+    // k encodes the path: the answer is where the path last turned left,
+    // that is k without its trailing right turns (1 bits) and the last left one
+#if defined(__GNUC__)
+    return k >> (__builtin_ctzll(~static_cast<unsigned long long>(k))+1);
+#else
+    while(k&1){ k >>= 1;}
+    return k>>1;
+#endif
+}
+
+template< class K, class V, class cmp >
+std::size_t FrozenBst<K,V,cmp>::next_pos(std::size_t k) const noexcept{
+    if(k==0){
+        return 0;
+    }
+
+    // 1. leftmost of right subtree
+    if(2*k+1<=keys.size()){
+        return leftmost_pos(2*k+1);
+    }
+
+    // 2. first ancestor whose left subtree holds k
+    while(k&1){ k >>= 1;}
+    return k>>1;
+}
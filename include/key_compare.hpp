@@ -0,0 +1,106 @@
+#pragma once
+
+#include <functional>   // for std::less
+#include <string>       // for std::basic_string
+#include <type_traits>  // for std::integral_constant, std::enable_if
+#include <utility>      // for std::declval
+
+//-------------------
+// Comparison policy
+//-------------------
+
+/// @brief Whether comparator cmp offers a three-way `int compare(a,b)` for keys of type A and B
+///        (negative if a comes first, zero if a and b are equivalent, positive otherwise).
+template< class cmp, class A, class B, class = void >
+struct has_three_way_compare: std::false_type{};
+
+template< class cmp, class A, class B >
+struct has_three_way_compare<cmp,A,B,
+        decltype((void)std::declval<const cmp&>().compare(std::declval<const A&>(),std::declval<const B&>()))>
+    : std::true_type{};
+
+/// @brief Whether cmp is std::less on arithmetic keys (plain built-in comparisons will do).
+template< class cmp, class A, class B >
+struct is_arithmetic_less: std::integral_constant<bool,
+        std::is_arithmetic<A>::value && std::is_arithmetic<B>::value
+        && (std::is_same<cmp,std::less<A>>::value || std::is_same<cmp,std::less<>>::value)>{};
+
+/// @brief Whether cmp is std::less on strings (std::basic_string::compare() will do).
+template< class cmp, class A, class B >
+struct is_string_less: std::false_type{};
+
+template< class C, class T, class Al >
+struct is_string_less<std::less<std::basic_string<C,T,Al>>,std::basic_string<C,T,Al>,std::basic_string<C,T,Al>>
+    : std::true_type{};
+
+/// @brief How compare_keys() compares keys of type A and B with cmp, best first.
+template< class cmp, class A, class B >
+using key_compare_kind = std::integral_constant<int,
+        is_arithmetic_less<cmp,A,B>::value? 0 :
+        has_three_way_compare<cmp,A,B>::value? 1 :
+        is_string_less<cmp,A,B>::value? 2 : 3>;
+
+/// @brief arithmetic keys: no function object, no branch.
+template< class cmp, class A, class B >
+inline int _compare_keys(const A& a, const B& b, std::integral_constant<int,0>){
+    return static_cast<int>(b<a)-static_cast<int>(a<b);
+}
+
+/// @brief comparators with their own three-way compare.
+template< class cmp, class A, class B >
+inline int _compare_keys(const A& a, const B& b, std::integral_constant<int,1>){
+    return cmp().compare(a,b);
+}
+
+/// @brief strings: a single pass over the characters.
+template< class cmp, class A, class B >
+inline int _compare_keys(const A& a, const B& b, std::integral_constant<int,2>){
+    return a.compare(b);
+}
+
+/// @brief any other comparator: the reverse order is only checked if a is not less than b.
+template< class cmp, class A, class B >
+inline int _compare_keys(const A& a, const B& b, std::integral_constant<int,3>){
+    return cmp()(a,b)? -1 : static_cast<int>(cmp()(b,a));
+}
+
+/// @brief Three-way comparison of a and b in cmp order, with the cheapest method
+///        available picked at compile time (see key_compare_kind).
+///        Descents call it once per level instead of evaluating cmp both ways.
+///
+/// @tparam cmp     Comparator class
+/// @param a        first key
+/// @param b        second key
+/// @return int     negative if a comes before b, zero if they are equivalent, positive otherwise
+template< class cmp, class A, class B >
+inline int compare_keys(const A& a, const B& b){
+    return _compare_keys<cmp>(a,b,key_compare_kind<cmp,A,B>{});
+}
+
+/// @brief Comparator adaptor counting how many times keys are compared
+///        (instrumentation, see the Comparisons test).
+///
+/// @tparam cmp         Comparator to wrap
+/// @tparam three_way   Whether to offer compare() too (one call per three-way comparison),
+///                     otherwise compare_keys() falls back to (up to) two calls of operator()
+template< class cmp, bool three_way = true >
+struct counting_compare{
+
+    /// @brief Comparisons made so far through any counting_compare<cmp,three_way>.
+    static unsigned long long& calls() noexcept{
+        static unsigned long long n{0};
+        return n;
+    }
+
+    template< class A, class B >
+    bool operator()(const A& a, const B& b) const{
+        ++calls();
+        return cmp()(a,b);
+    }
+
+    template< class A, class B, bool tw = three_way, class = typename std::enable_if<tw>::type >
+    int compare(const A& a, const B& b) const{
+        ++calls();
+        return compare_keys<cmp>(a,b);
+    }
+};
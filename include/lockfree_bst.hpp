@@ -0,0 +1,674 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>      // for std::uintptr_t
+#include <functional>   // for std::less
+#include <stdexcept>    // for std::out_of_range
+#include <utility>      // for std::pair, std::forward
+#include <vector>
+
+#include "key_compare.hpp"
+
+
+//--------------------------------
+// Epoch-based memory reclamation
+//--------------------------------
+
+/// @brief Epoch-based reclamation domain.
+///
+/// Threads work on the shared structure inside guards. A guard announces the global
+/// epoch it started in; objects unlinked from the structure are retired with the
+/// epoch current at that time, and freed once the global epoch is two steps further:
+/// the epoch only moves on when every thread inside a guard has seen the current one,
+/// so by then nobody can still hold a pointer to them.
+///
+/// Each guard borrows a per-thread record (announced epoch + retired objects);
+/// records are recycled, cached per thread and only freed with the domain.
+class epoch_domain{
+
+    /// @brief An unlinked object waiting to be freed.
+    struct Retired{
+        void* p;
+        void (*deleter)(void*);
+        unsigned long epoch;    ///< global epoch when it was retired
+    };
+
+    /// @brief Per-thread state, borrowed by guards.
+    struct Record{
+        std::atomic<bool> in_use{false};        ///< a guard holds it (the thread is inside)
+        std::atomic<unsigned long> epoch{0};    ///< epoch announced by the guard
+        std::vector<Retired> retired;           ///< only touched by the guard holding the record
+        Record* next{nullptr};
+    };
+
+    /// @brief Retirements between two attempts to advance the epoch and free objects.
+    static constexpr std::size_t collect_period{64};
+
+    std::atomic<unsigned long> global{0};
+    std::atomic<Record*> records{nullptr};
+    const unsigned long id;     ///< tells domains apart in the per-thread record cache
+
+    static unsigned long new_id() noexcept{
+        static std::atomic<unsigned long> next{1};
+        return next.fetch_add(1);
+    }
+
+    /// @brief Takes a free record (the one this thread used last, if possible), or adds one.
+    Record* acquire();
+
+    /// @brief Moves the global epoch on if every thread inside a guard has seen it.
+    void try_advance() noexcept;
+
+    /// @brief Frees the objects of r retired at least two epochs ago.
+    void collect(Record* r) noexcept;
+
+  public:
+
+    epoch_domain(): id{new_id()}{}
+
+    // records are referenced by guards and thread caches
+    epoch_domain(const epoch_domain&) = delete;
+    epoch_domain& operator=(const epoch_domain&) = delete;
+
+    /// @brief Frees every retired object and every record. No thread may be inside a guard.
+    ~epoch_domain();
+
+    /// @brief Critical section: pointers read from the structure stay valid while it lives.
+    class guard{
+
+        epoch_domain& domain;
+        Record* rec;
+
+      public:
+        explicit guard(epoch_domain& d): domain(d), rec(d.acquire()){
+            rec->epoch.store(domain.global.load(),std::memory_order_relaxed);
+            // the announcement is visible before anything is read from the structure
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        ~guard(){ rec->in_use.store(false,std::memory_order_release);}
+
+        guard(const guard&) = delete;
+        guard& operator=(const guard&) = delete;
+
+        /// @brief Hands over an object unlinked from the structure, to be deleted when safe.
+        ///
+        /// @tparam T   type to delete p as
+        /// @param p    unlinked object
+        template< class T >
+        void retire(T* p){
+            rec->retired.push_back(Retired{p,[](void* q){ delete static_cast<T*>(q);},domain.global.load()});
+            if(rec->retired.size()%collect_period==0){
+                domain.try_advance();
+                domain.collect(rec);
+            }
+        }
+    };
+};
+
+
+//---------------
+// Lock-free bst
+//---------------
+
+/// @brief Lock-free ordered map: a concurrent external binary search tree
+///        (Natarajan and Mittal, "Fast concurrent lock-free binary search trees", PPoPP 2014).
+///
+/// Key/value pairs sit in the leaves, inner nodes only route searches. Every operation
+/// may be called from any number of threads at once, with no lock:
+/// - insert() links a new inner node and a new leaf with a single CAS
+/// - erase() first flags the edge to the leaf (the element is then logically gone),
+///   then tags the edge to its sibling, which freezes the parent, and finally
+///   swings the edge above the parent to the sibling; threads finding flagged or
+///   tagged edges on their way help finishing the removal instead of waiting
+/// - find() just walks down
+/// Flags and tags are the two low bits of the child links. Unlinked nodes are freed
+/// through epoch-based reclamation (see epoch_domain).
+///
+/// The tree is not balanced: its height depends on the insertion order, as for an
+/// unbalanced Bst. Leaves never change once linked, hence lookups and iteration return
+/// copies of the pairs. Iteration is ordered and weakly consistent: it sees every key
+/// present throughout, none twice, and may or may not see the keys inserted or erased
+/// meanwhile.
+///
+/// K must be default constructible (three sentinel nodes with "infinite" keys bound
+/// the tree), V copy constructible.
+///
+/// @tparam K       Type of the keys
+/// @tparam V       Type of the values
+/// @tparam cmp     Comparator class (default: std::less<K>)
+template< class K, class V, class cmp = std::less<K> >
+class LockFreeBst{
+
+  public:
+    using kvpair = std::pair<const K,V>;
+
+  private:
+
+    using edge = std::uintptr_t;
+
+    static constexpr edge flag_bit{1};  ///< the leaf below is being erased
+    static constexpr edge tag_bit{2};   ///< the edge is frozen (its parent is being unlinked)
+
+    /// @brief Builds the sentinel "infinity inf-1" (inf in 1..3).
+    struct sentinel{ unsigned char inf;};
+
+    struct Node{
+        K key;
+        unsigned char inf;          ///< 0: key is meaningful, 1/2/3: sentinels "infinity 0/1/2"
+        std::atomic<edge> left{0};
+        std::atomic<edge> right{0};
+
+        Node(const K& k, unsigned char i): key(k), inf(i){}
+        explicit Node(sentinel s): key(), inf(s.inf){}
+
+        bool is_leaf() const noexcept{ return left.load(std::memory_order_acquire)==0;}
+    };
+
+    struct Leaf: Node{
+        V value;
+
+        template< class... VArgs >
+        Leaf(const K& k, VArgs&&... vargs): Node(k,0), value(std::forward<VArgs>(vargs)...){}
+        explicit Leaf(sentinel s): Node(s), value(){}
+    };
+
+    /// @brief Where a seek ended: the leaf, its parent, and the last untagged edge
+    ///        (ancestor->successor) above them.
+    struct SeekRecord{
+        Node* ancestor;
+        Node* successor;
+        Node* parent;
+        Node* leaf;
+    };
+
+    Node* root;                     ///< inner sentinel "infinity 2" (R)
+    Node* s;                        ///< inner sentinel "infinity 1" (S), left child of root
+    mutable epoch_domain domain;
+
+    static Node* address(edge e) noexcept{ return reinterpret_cast<Node*>(e & ~(flag_bit|tag_bit));}
+    static edge link(const Node* n) noexcept{ return reinterpret_cast<edge>(n);}
+
+    /// @brief Whether key goes left of node n (finite keys go left of every sentinel).
+    static bool goes_left(const K& key, const Node* n){ return n->inf!=0 || cmp()(key,n->key);}
+
+    /// @brief Whether leaf n holds key.
+    static bool holds(const Node* n, const K& key){ return n->inf==0 && compare_keys<cmp>(key,n->key)==0;}
+
+    /// @brief Child link of n on the side key goes to.
+    static std::atomic<edge>& child(Node* n, const K& key){ return goes_left(key,n)? n->left : n->right;}
+
+    /// @brief Walks down to the leaf where key belongs.
+    SeekRecord seek(const K& key) const;
+
+    /// @brief Tries to unlink the leaf flagged below sr.parent (and the parent itself).
+    ///
+    /// @return bool whether this call did it
+    bool cleanup(const K& key, const SeekRecord& sr, epoch_domain::guard& g);
+
+    /// @brief Retires the nodes cut off by a successful cleanup: the path from successor
+    ///        down to parent and the flagged leaves hanging from it, but the kept subtree.
+    void retire_path(const K& key, Node* successor, Node* parent, Node* kept, epoch_domain::guard& g);
+
+    /// @brief Copy of the first pair whose key is greater than key (or not less, if inclusive).
+    ///
+    /// @return bool false if there is none
+    bool next_pair(const K* key, bool inclusive, std::pair<K,V>& out) const;
+
+    /// @brief Deletes every node (no other thread may be using the tree).
+    void destroy() noexcept;
+
+  public:
+
+    /// @brief Weakly consistent, ordered, read-only iterator. Holds a copy of the current pair:
+    ///        each increment looks for the next key in the tree as it is at that moment.
+    class const_iterator{
+
+        const LockFreeBst* tree;
+        bool at_end;
+        std::pair<K,V> current;
+
+        friend class LockFreeBst;
+
+        explicit const_iterator(const LockFreeBst* t): tree(t), at_end(true), current(){}
+
+      public:
+
+        bool operator==(const const_iterator& rhs) const{
+            return at_end==rhs.at_end && (at_end || compare_keys<cmp>(current.first,rhs.current.first)==0);
+        }
+        bool operator!=(const const_iterator& rhs) const{return !(*this == rhs);}
+
+        /// @brief pre-increment.
+        const_iterator& operator++(){
+            at_end = !tree->next_pair(&current.first,false,current);
+            return *this;
+        }
+
+        /// @brief de-reference op.
+        ///
+        /// @return const std::pair<K,V>& copy of the current pair
+        const std::pair<K,V>& operator*() const{
+            if(at_end){
+                throw std::out_of_range("LockFreeBst iterator out of range!");
+            }
+            return current;
+        }
+    };
+
+    typedef const_iterator iterator;
+
+    LockFreeBst();
+    ~LockFreeBst(){ destroy();}
+
+    // threads may hold pointers to nodes: the tree is neither copied nor moved
+    LockFreeBst(const LockFreeBst&) = delete;
+    LockFreeBst& operator=(const LockFreeBst&) = delete;
+
+    // Iterator interface -----------------------------------------------------
+
+    const_iterator begin() const{
+        const_iterator it{this};
+        it.at_end = !next_pair(nullptr,true,it.current);
+        return it;
+    }
+    const_iterator cbegin() const{ return begin();}
+
+    const_iterator end() const{ return const_iterator{this};}
+    const_iterator cend() const{ return const_iterator{this};}
+
+    /// @brief Iterator to the first element whose key is not less than key.
+    const_iterator lower_bound(const K& key) const{
+        const_iterator it{this};
+        it.at_end = !next_pair(&key,true,it.current);
+        return it;
+    }
+
+    // Operations -------------------------------------------------------------
+
+    /// @brief Inserts an element whose value is built from given args, unless key is present.
+    ///
+    /// @return bool whether the element was inserted
+    template< class... vctorargtypes >
+    bool emplace(const K& key, vctorargtypes&&... vctorargs);
+
+    /// @brief Inserts a copy of given pair, unless its key is present.
+    ///
+    /// @return bool whether the pair was inserted
+    bool insert(const kvpair& kv){ return emplace(kv.first,kv.second);}
+
+    /// @brief Removes the element at given key.
+    ///
+    /// @return bool whether this call removed it
+    bool erase(const K& key);
+
+    /// @brief Looks for key and copies the value stored there.
+    ///
+    /// @param key      key to look for
+    /// @param value    (out) copy of the value at key, untouched if not found
+    /// @return bool    whether key was found
+    bool find(const K& key, V& value) const;
+
+    /// @brief Whether given key is present.
+    bool contains(const K& key) const;
+
+    /// @brief Counts the elements by walking them (weakly consistent, O(N)).
+    unsigned int get_size() const;
+};
+
+
+//#############################################################################
+//DEFINITIONS
+//#############################################################################
+
+// epoch_domain
+
+inline epoch_domain::Record* epoch_domain::acquire(){
+    static thread_local unsigned long cached_id{0};
+    static thread_local Record* cached{nullptr};
+
+    bool free{false};
+    if(cached_id==id && cached->in_use.compare_exchange_strong(free,true)){
+        return cached;
+    }
+
+    Record* r{records.load()};
+    for(; r; r=r->next){
+        free = false;
+        if(!r->in_use.load(std::memory_order_relaxed) && r->in_use.compare_exchange_strong(free,true)){
+            break;
+        }
+    }
+
+    // all taken: one more thread than ever before
+    if(!r){
+        r = new Record;
+        r->in_use.store(true);
+        r->next = records.load();
+        while(!records.compare_exchange_weak(r->next,r)){}
+    }
+
+    cached_id = id;
+    cached = r;
+    return r;
+}
+
+inline void epoch_domain::try_advance() noexcept{
+    unsigned long g{global.load()};
+    for(Record* r{records.load()}; r; r=r->next){
+        if(r->in_use.load() && r->epoch.load()!=g){
+            return;
+        }
+    }
+    global.compare_exchange_strong(g,g+1);
+}
+
+inline void epoch_domain::collect(Record* r) noexcept{
+    unsigned long g{global.load()};
+    std::size_t kept{0};
+    for(std::size_t iii{0}; iii<r->retired.size(); ++iii){
+        Retired& x{r->retired[iii]};
+        if(x.epoch+2<=g){
+            x.deleter(x.p);
+        }
+        else{
+            r->retired[kept++] = x;
+        }
+    }
+    r->retired.resize(kept);
+}
+
+inline epoch_domain::~epoch_domain(){
+    Record* r{records.load()};
+    while(r){
+        for(Retired& x: r->retired){ x.deleter(x.p);}
+        Record* next{r->next};
+        delete r;
+        r = next;
+    }
+}
+
+// LockFreeBst
+
+template< class K, class V, class cmp >
+constexpr typename LockFreeBst<K,V,cmp>::edge LockFreeBst<K,V,cmp>::flag_bit;
+
+template< class K, class V, class cmp >
+constexpr typename LockFreeBst<K,V,cmp>::edge LockFreeBst<K,V,cmp>::tag_bit;
+
+template< class K, class V, class cmp >
+LockFreeBst<K,V,cmp>::LockFreeBst(){
+    // R(inf2) -> [S(inf1) -> [leaf inf0, leaf inf1], leaf inf2]: every real key goes
+    // to the left of S, whose left subtree always holds (at least) the leaf inf0
+    root = new Node(sentinel{3});
+    s = new Node(sentinel{2});
+    root->left.store(link(s));
+    root->right.store(link(new Leaf(sentinel{3})));
+    s->left.store(link(new Leaf(sentinel{1})));
+    s->right.store(link(new Leaf(sentinel{2})));
+}
+
+template< class K, class V, class cmp >
+typename LockFreeBst<K,V,cmp>::SeekRecord LockFreeBst<K,V,cmp>::seek(const K& key) const{
+    SeekRecord sr{root,s,s,address(s->left.load())};
+    edge parent_field{s->left.load()};
+    edge current_field{sr.leaf->left.load()};
+    Node* current{address(current_field)};
+
+    while(current){
+        // the last untagged edge met is where a removal would start from
+        if(!(parent_field & tag_bit)){
+            sr.ancestor = sr.parent;
+            sr.successor = sr.leaf;
+        }
+        sr.parent = sr.leaf;
+        sr.leaf = current;
+
+        parent_field = current_field;
+        current_field = child(current,key).load();
+        current = address(current_field);
+    }
+    return sr;
+}
+
+template< class K, class V, class cmp >
+bool LockFreeBst<K,V,cmp>::cleanup(const K& key, const SeekRecord& sr, epoch_domain::guard& g){
+    Node* ancestor{sr.ancestor};
+    Node* successor{sr.successor};
+    Node* parent{sr.parent};
+
+    std::atomic<edge>& successor_edge{child(ancestor,key)};
+    std::atomic<edge>* child_edge;
+    std::atomic<edge>* sibling_edge;
+    if(goes_left(key,parent)){
+        child_edge = &parent->left;
+        sibling_edge = &parent->right;
+    }
+    else{
+        child_edge = &parent->right;
+        sibling_edge = &parent->left;
+    }
+
+    // the flagged leaf is the other one: the subtree on key's side stays
+    if(!(child_edge->load() & flag_bit)){
+        sibling_edge = child_edge;
+    }
+
+    // freeze the edge to what stays, then hang it from the ancestor (keeping its flag, if any)
+    sibling_edge->fetch_or(tag_bit);
+    edge kept{sibling_edge->load()};
+    edge expected{link(successor)};
+    if(successor_edge.compare_exchange_strong(expected,kept & ~tag_bit)){
+        retire_path(key,successor,parent,address(kept),g);
+        return true;
+    }
+    return false;
+}
+
+template< class K, class V, class cmp >
+void LockFreeBst<K,V,cmp>::retire_path(const K& key, Node* successor, Node* parent, Node* kept, epoch_domain::guard& g){
+    // every node on the way has a frozen edge going on along the path and a flagged leaf
+    // on the other side; the parent has the kept subtree and a flagged leaf
+    Node* n{successor};
+    while(true){
+        Node* l{address(n->left.load())};
+        Node* r{address(n->right.load())};
+        Node* next{goes_left(key,n)? l : r};
+        Node* other{goes_left(key,n)? r : l};
+        if(n==parent){
+            g.retire(static_cast<Leaf*>(next==kept? other : next));
+            g.retire(n);
+            return;
+        }
+        g.retire(static_cast<Leaf*>(other));
+        g.retire(n);
+        n = next;
+    }
+}
+
+template< class K, class V, class cmp >
+template< class... vctorargtypes >
+bool LockFreeBst<K,V,cmp>::emplace(const K& key, vctorargtypes&&... vctorargs){
+    epoch_domain::guard g{domain};
+
+    Leaf* new_leaf{nullptr};
+    Node* new_inner{nullptr};
+    while(true){
+        SeekRecord sr{seek(key)};
+        Node* leaf{sr.leaf};
+        if(holds(leaf,key)){
+            delete new_leaf;
+            delete new_inner;
+            return false;
+        }
+
+        if(!new_leaf){
+            new_leaf = new Leaf(key,std::forward<vctorargtypes>(vctorargs)...);
+            try{
+                new_inner = new Node(key,0);
+            }
+            catch(...){
+                delete new_leaf;
+                throw;
+            }
+        }
+
+        // the new inner node routes between the leaf found and the new one
+        if(goes_left(key,leaf)){
+            new_inner->key = leaf->key;
+            new_inner->inf = leaf->inf;
+            new_inner->left.store(link(new_leaf),std::memory_order_relaxed);
+            new_inner->right.store(link(leaf),std::memory_order_relaxed);
+        }
+        else{
+            new_inner->key = key;
+            new_inner->inf = 0;
+            new_inner->left.store(link(leaf),std::memory_order_relaxed);
+            new_inner->right.store(link(new_leaf),std::memory_order_relaxed);
+        }
+
+        std::atomic<edge>& child_edge{child(sr.parent,key)};
+        edge expected{link(leaf)};
+        if(child_edge.compare_exchange_strong(expected,link(new_inner))){
+            return true;
+        }
+
+        // the leaf is on its way out: help, then try again
+        if(address(expected)==leaf && (expected & (flag_bit|tag_bit))){
+            cleanup(key,sr,g);
+        }
+    }
+}
+
+template< class K, class V, class cmp >
+bool LockFreeBst<K,V,cmp>::erase(const K& key){
+    epoch_domain::guard g{domain};
+
+    bool injected{false};   // whether this call flagged the leaf
+    Node* leaf{nullptr};
+    while(true){
+        SeekRecord sr{seek(key)};
+
+        if(!injected){
+            leaf = sr.leaf;
+            if(!holds(leaf,key)){
+                return false;
+            }
+
+            // flag the edge to the leaf: from now on the key is gone
+            std::atomic<edge>& child_edge{child(sr.parent,key)};
+            edge expected{link(leaf)};
+            if(child_edge.compare_exchange_strong(expected,link(leaf)|flag_bit)){
+                injected = true;
+                if(cleanup(key,sr,g)){
+                    return true;
+                }
+            }
+            else if(address(expected)==leaf && (expected & (flag_bit|tag_bit))){
+                cleanup(key,sr,g);
+            }
+        }
+        else{
+            // someone else finished the job
+            if(sr.leaf!=leaf || cleanup(key,sr,g)){
+                return true;
+            }
+        }
+    }
+}
+
+template< class K, class V, class cmp >
+bool LockFreeBst<K,V,cmp>::find(const K& key, V& value) const{
+    epoch_domain::guard g{domain};
+    Node* n{address(s->left.load())};
+    while(!n->is_leaf()){
+        n = address(child(n,key).load());
+    }
+    if(!holds(n,key)){
+        return false;
+    }
+    value = static_cast<Leaf*>(n)->value;
+    return true;
+}
+
+template< class K, class V, class cmp >
+bool LockFreeBst<K,V,cmp>::contains(const K& key) const{
+    epoch_domain::guard g{domain};
+    Node* n{address(s->left.load())};
+    while(!n->is_leaf()){
+        n = address(child(n,key).load());
+    }
+    return holds(n,key);
+}
+
+template< class K, class V, class cmp >
+bool LockFreeBst<K,V,cmp>::next_pair(const K* key, bool inclusive, std::pair<K,V>& out) const{
+    epoch_domain::guard g{domain};
+
+    auto before = [key,inclusive](const Node* n){
+        return key && n->inf==0 && (inclusive? cmp()(n->key,*key) : !cmp()(*key,n->key));
+    };
+
+    while(true){
+        // walk down towards key, remembering the last subtree skipped on the right
+        Node* n{address(s->left.load())};
+        Node* fallback{nullptr};
+        while(!n->is_leaf()){
+            if(!key || goes_left(*key,n)){
+                fallback = address(n->right.load());
+                n = address(n->left.load());
+            }
+            else{
+                n = address(n->right.load());
+            }
+        }
+
+        // the leaf reached, if past key, or else the first leaf of the fallback subtree
+        if(before(n)){
+            if(!fallback){
+                return false;
+            }
+            n = fallback;
+            while(!n->is_leaf()){
+                n = address(n->left.load());
+            }
+        }
+        if(n->inf!=0){
+            return false;
+        }
+
+        // an erase may have hoisted the fallback subtree meanwhile, and smaller keys
+        // may have been inserted there: look again
+        if(before(n)){
+            continue;
+        }
+        out.first = n->key;
+        out.second = static_cast<Leaf*>(n)->value;
+        return true;
+    }
+}
+
+template< class K, class V, class cmp >
+unsigned int LockFreeBst<K,V,cmp>::get_size() const{
+    unsigned int n{0};
+    for(auto it{cbegin()}; it!=cend(); ++it){ ++n;}
+    return n;
+}
+
+template< class K, class V, class cmp >
+void LockFreeBst<K,V,cmp>::destroy() noexcept{
+    // the tree may be as deep as it is large: explicit stack
+    std::vector<Node*> stack{root};
+    while(!stack.empty()){
+        Node* n{stack.back()};
+        stack.pop_back();
+        if(n->is_leaf()){
+            delete static_cast<Leaf*>(n);
+        }
+        else{
+            stack.push_back(address(n->left.load()));
+            stack.push_back(address(n->right.load()));
+            delete n;
+        }
+    }
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstddef>      // for std::size_t
+#include <new>          // for ::operator new/delete
+#include <type_traits>  // for std::aligned_storage
+#include <utility>      // for std::swap
+
+/// @brief Default node allocation policy.
+///
+/// Every node gets its own heap allocation, exactly as a plain new/delete would do.
+///
+/// @tparam T Type of the objects to allocate (the bst Node)
+template< class T >
+class heap_allocator{
+  public:
+
+    /// @brief Whether release() frees every node at once
+    ///        (if so, trivially destructible nodes need not be visited one by one).
+    static constexpr bool bulk_release{false};
+
+    /// @brief Gets raw memory for a single T.
+    ///
+    /// @return T* uninitialized storage
+    T* allocate(){ return static_cast<T*>(::operator new(sizeof(T)));}
+
+    /// @brief Gives back the memory of a single (already destroyed) T.
+    ///
+    /// @param p pointer obtained from allocate()
+    void deallocate(T* p) noexcept{ ::operator delete(p);}
+
+    /// @brief Hint that n allocations are about to follow. Nothing to do here.
+    void reserve(std::size_t) noexcept{}
+
+    /// @brief Frees all memory held by the allocator. Nothing to do here,
+    ///        as nodes are returned one by one through deallocate().
+    void release() noexcept{}
+
+    void swap(heap_allocator&) noexcept{}
+};
+
+/// @brief Arena (slab) node allocation policy.
+///
+/// Nodes are carved out of large contiguous blocks, so that building a tree
+/// costs a handful of allocations instead of one per node and nodes inserted
+/// one after another end up next to each other in memory.
+/// Deallocated nodes are kept in a free list and recycled by later allocations,
+/// while the blocks themselves are only given back all at once by release().
+///
+/// @tparam T Type of the objects to allocate (the bst Node)
+template< class T >
+class arena_allocator{
+
+    /// @brief A slot holds either a T or the link to the next free slot.
+    union Slot{
+        Slot* next;
+        typename std::aligned_storage<sizeof(T),alignof(T)>::type storage;
+    };
+
+    static constexpr std::size_t first_block_size{64};      ///< slots in the first block
+    static constexpr std::size_t max_block_size{1<<16};     ///< cap on block growth
+
+    Slot* blocks{nullptr};      ///< list of blocks (first slot of each one links the previous block)
+    Slot* free_list{nullptr};   ///< recycled slots
+    Slot* cursor{nullptr};      ///< next never used slot in the current block
+    Slot* block_end{nullptr};   ///< one past the last slot of the current block
+    std::size_t next_block_size{first_block_size};
+
+    /// @brief Allocates a new block and makes it the current one.
+    /// 
+    /// @param min_size minimum number of slots of the new block
+    void grow(std::size_t min_size = 0);
+
+  public:
+
+    /// @brief Whether release() frees every node at once
+    ///        (if so, trivially destructible nodes need not be visited one by one).
+    static constexpr bool bulk_release{true};
+
+    arena_allocator() = default;
+
+    // Arenas own their nodes, hence they can be moved but not copied
+
+    arena_allocator(const arena_allocator&) = delete;
+    arena_allocator& operator=(const arena_allocator&) = delete;
+
+    arena_allocator(arena_allocator&& other) noexcept{ swap(other);}
+    arena_allocator& operator=(arena_allocator&& other) noexcept{
+        if(this != &other){
+            release();
+            swap(other);
+        }
+        return *this;
+    }
+
+    ~arena_allocator(){ release();}
+
+    /// @brief Gets raw memory for a single T, recycling freed slots first.
+    ///
+    /// @return T* uninitialized storage
+    T* allocate(){
+        if(free_list){
+            Slot* s{free_list};
+            free_list = s->next;
+            return reinterpret_cast<T*>(s);
+        }
+        if(cursor==block_end){ grow();}
+        return reinterpret_cast<T*>(cursor++);
+    }
+
+    /// @brief Puts the memory of a single (already destroyed) T in the free list.
+    ///
+    /// @param p pointer obtained from allocate()
+    void deallocate(T* p) noexcept{
+        Slot* s{reinterpret_cast<Slot*>(p)};
+        s->next = free_list;
+        free_list = s;
+    }
+
+    /// @brief Makes sure the next n allocations are served by a single
+    ///        contiguous block (a new one is carved out if the current one is too small).
+    /// 
+    /// @param n number of allocations about to follow
+    void reserve(std::size_t n){
+        if(static_cast<std::size_t>(block_end-cursor)<n){ grow(n);}
+    }
+
+    /// @brief Frees all the blocks in one go.
+    ///        Any T still living in the arena must have been destroyed already
+    ///        (or be trivially destructible).
+    void release() noexcept;
+
+    void swap(arena_allocator& other) noexcept{
+        std::swap(blocks,other.blocks);
+        std::swap(free_list,other.free_list);
+        std::swap(cursor,other.cursor);
+        std::swap(block_end,other.block_end);
+        std::swap(next_block_size,other.next_block_size);
+    }
+};
+
+
+//#############################################################################
+//DEFINITIONS
+//#############################################################################
+
+template< class T >
+void arena_allocator<T>::grow(std::size_t min_size){
+    std::size_t block_size{next_block_size<min_size? min_size : next_block_size};
+
+    // one extra slot at the front links the previous block
+    Slot* b{new Slot[block_size+1]};
+    b->next = blocks;
+    blocks = b;
+
+    cursor = b+1;
+    block_end = cursor+block_size;
+
+    if(next_block_size<max_block_size){ next_block_size*=2;}
+}
+
+template< class T >
+void arena_allocator<T>::release() noexcept{
+    while(blocks){
+        Slot* prev{blocks->next};
+        delete[] blocks;
+        blocks = prev;
+    }
+    free_list = nullptr;
+    cursor = nullptr;
+    block_end = nullptr;
+    next_block_size = first_block_size;
+}
@@ -0,0 +1,486 @@
+#pragma once
+
+#include <atomic>
+#include <functional>   // for std::less
+#include <stdexcept>    // for std::out_of_range
+#include <tuple>        // for std::forward_as_tuple
+#include <utility>      // for std::pair, std::forward, std::piecewise_construct
+#include <vector>
+
+#include "key_compare.hpp"
+
+
+/// @brief Persistent (path-copying) avl tree: copies share all of their nodes and
+///        cost O(1), changes copy the O(log N) nodes on the path they touch.
+///
+/// Nodes are reference counted and never changed once shared: a version that wants
+/// to change a node referenced by other versions too makes its own copy of it (and
+/// of every node above it), leaving the old one to them. Nodes referenced by a single
+/// version are changed in place, so that a tree that is never copied costs about as
+/// much as a plain one. A node is freed with the last version referencing it.
+///
+/// Since a node may belong to many trees at once, nodes have no parent link:
+/// iterators keep the path from the root in a stack.
+///
+/// Versions can be handed to other threads (reference counts are atomic): a snapshot
+/// can be read by one thread while another keeps changing the tree it was taken from.
+/// A single version must not be used by two threads at once, though.
+///
+/// @tparam K       Type of the keys
+/// @tparam V       Type of the values
+/// @tparam cmp     Comparator class (default: std::less<K>)
+template< class K, class V, class cmp = std::less<K> >
+class PersistentBst{
+
+  public:
+    using kvpair = std::pair<const K,V>;
+
+  private:
+
+    struct Node{
+        kvpair kv;
+
+        Node* l_child{nullptr};
+        Node* r_child{nullptr};
+
+        int height{0}; ///< height of the subtree rooted at this node
+
+        std::atomic<unsigned int> refs{1}; ///< versions (and parent nodes) referencing this node
+
+        /// @brief Construct a new Node object building kv in place.
+        template< class KT, class... VArgs >
+        Node(std::piecewise_construct_t, KT&& key, VArgs&&... vargs):
+            kv{std::piecewise_construct,
+               std::forward_as_tuple(std::forward<KT>(key)),
+               std::forward_as_tuple(std::forward<VArgs>(vargs)...)}{};
+
+        /// @brief Copy of a node: the children get one more reference.
+        Node(const Node& n):
+            kv{n.kv},
+            l_child{retain(n.l_child)},
+            r_child{retain(n.r_child)},
+            height{n.height}{};
+    };
+
+    Node* root;
+    unsigned int size;
+
+    /// @brief Bound on the height of an avl tree of up to 2^32 nodes (about 1.44*log2(N)),
+    ///        hence on the length of the paths kept by insertions and removals.
+    static constexpr int max_height{64};
+
+    /// @brief Adds a reference to n (may be nullptr).
+    static Node* retain(Node* n) noexcept{
+        if(n){ n->refs.fetch_add(1,std::memory_order_relaxed);}
+        return n;
+    }
+
+    /// @brief Drops a reference to n (may be nullptr), freeing the nodes nobody references anymore.
+    static void release(Node* n) noexcept;
+
+    /// @brief Takes a reference to n and returns an equivalent node that only the caller
+    ///        references: n itself if it is not shared, or else a copy of it.
+    ///
+    /// @param n        node whose reference is handed over
+    /// @return Node*   node that can be changed in place
+    static Node* own(Node* n);
+
+    static int node_height(const Node* n) noexcept{ return n? n->height : -1;}
+
+    static void update_height(Node* n) noexcept{
+        int hl{node_height(n->l_child)}, hr{node_height(n->r_child)};
+        n->height = 1 + (hl>hr?hl:hr);
+    }
+
+    /// @brief Rotations and rebalancing of owned subtree roots (children are owned on demand).
+    ///        If copying a child fails, the subtree is left as it was.
+    ///
+    /// @return Node* new root of the subtree
+    static Node* rotate_left(Node* n);
+    static Node* rotate_right(Node* n);
+    static Node* rebalance(Node* n);
+
+    /// @brief Node holding key, copying the path to it as needed so that it can be changed.
+    ///
+    /// @return Node* the node (nullptr if key is not present)
+    Node* owned_node(const K& key);
+
+    const Node* find_node(const K& key) const noexcept;
+
+  public:
+
+    /// @brief Read-only iterator. Keeps the way back to the root in a stack:
+    ///        the current node on top, below it the ancestors still to be visited.
+    class const_iterator{
+
+        std::vector<const Node*> stack;
+
+        friend class PersistentBst;
+
+        /// @brief Pushes n and its chain of left children.
+        void push_left(const Node* n){
+            for(; n; n=n->l_child){ stack.push_back(n);}
+        }
+
+      public:
+        const_iterator() = default;
+
+        bool operator==(const const_iterator& rhs) const{
+            return stack.empty()? rhs.stack.empty() : (!rhs.stack.empty() && stack.back()==rhs.stack.back());
+        }
+        bool operator!=(const const_iterator& rhs) const{return !(*this == rhs);}
+
+        /// @brief pre-increment.
+        const_iterator& operator++(){
+            if(!stack.empty()){
+                const Node* n{stack.back()};
+                stack.pop_back();
+                push_left(n->r_child);
+            }
+            return *this;
+        }
+
+        /// @brief post-increment.
+        const_iterator operator++(int){
+            const_iterator cp{*this};
+            ++(*this);
+            return cp;
+        }
+
+        /// @brief de-reference op.
+        const kvpair& operator*() const{
+            if(stack.empty()){
+                throw std::out_of_range("PersistentBst iterator out of range!");
+            }
+            return stack.back()->kv;
+        }
+    };
+
+    typedef const_iterator iterator;
+
+    // ctors, dtors -----------------------------------------------------------
+    PersistentBst(): root{nullptr}, size{0}{};
+
+    ~PersistentBst(){ release(root);}
+
+    /// @brief Copy ctor: O(1), the copy shares every node.
+    PersistentBst(const PersistentBst& rhs): root{retain(rhs.root)}, size{rhs.size}{};
+
+    /// @brief Move ctor.
+    PersistentBst(PersistentBst&& rhs) noexcept: root{rhs.root}, size{rhs.size}{
+        rhs.root = nullptr;
+        rhs.size = 0;
+    }
+
+    /// @brief Copy assignment: O(1), plus freeing the nodes nobody references anymore.
+    PersistentBst& operator=(const PersistentBst& rhs){
+        Node* old{root};
+        root = retain(rhs.root);
+        size = rhs.size;
+        release(old);
+        return *this;
+    }
+
+    /// @brief Move assignment.
+    PersistentBst& operator=(PersistentBst&& rhs) noexcept{
+        if(this!=&rhs){
+            release(root);
+            root = rhs.root;
+            size = rhs.size;
+            rhs.root = nullptr;
+            rhs.size = 0;
+        }
+        return *this;
+    }
+
+    /// @brief Point-in-time copy of the tree, O(1). The tree and the snapshot can then
+    ///        change independently, each copying the nodes it touches.
+    PersistentBst snapshot() const{ return *this;}
+
+    // Iterator interface -----------------------------------------------------
+
+    const_iterator begin() const{
+        const_iterator it;
+        it.push_left(root);
+        return it;
+    }
+    const_iterator cbegin() const{ return begin();}
+
+    const_iterator end() const{ return const_iterator{};}
+    const_iterator cend() const{ return const_iterator{};}
+
+    // Operations -------------------------------------------------------------
+
+    /// @brief Inserts an element whose value is built from given args, unless key is present
+    ///        (then nothing is built nor copied).
+    ///
+    /// @return bool whether the element was inserted
+    template< class... vctorargtypes >
+    bool emplace(const K& key, vctorargtypes&&... vctorargs);
+
+    /// @brief Inserts a copy of given pair, unless its key is present.
+    ///
+    /// @return bool whether the pair was inserted
+    bool insert(const kvpair& kv){ return emplace(kv.first,kv.second);}
+
+    /// @brief Stores value at key, replacing the previous one if key is present.
+    void insert_or_assign(const K& key, const V& value){ (*this)[key] = value;}
+
+    /// @brief Returns a reference to the value at key, inserting a default one if key
+    ///        is not present. The path to the node is copied if shared, so that other
+    ///        versions do not see the changes made through the reference.
+    V& operator[](const K& key);
+
+    /// @brief Removes the element at given key.
+    ///
+    /// @return bool whether key was present
+    bool erase(const K& key);
+
+    /// @brief Iterator to the element with given key (end() if not present).
+    const_iterator find(const K& key) const;
+
+    /// @brief Whether given key is present.
+    bool contains(const K& key) const noexcept{ return find_node(key)!=nullptr;}
+
+    /// @brief Iterator to the first element whose key is not less than key.
+    const_iterator lower_bound(const K& key) const;
+
+    /// @brief Drops every element (nodes shared with other versions stay there).
+    void clear() noexcept{
+        release(root);
+        root = nullptr;
+        size = 0;
+    }
+
+    /// @brief Getter for the number of elements.
+    unsigned int get_size() const noexcept{return size;}
+
+    /// @brief Height of the tree (-1 if empty).
+    int get_height() const noexcept{return node_height(root);}
+};
+
+
+//#############################################################################
+//DEFINITIONS
+//#############################################################################
+
+template< class K, class V, class cmp >
+constexpr int PersistentBst<K,V,cmp>::max_height;
+
+template< class K, class V, class cmp >
+void PersistentBst<K,V,cmp>::release(Node* n) noexcept{
+    // the left subtree by recursion (depth O(log N)), the right one by iteration
+    while(n && n->refs.fetch_sub(1,std::memory_order_acq_rel)==1){
+        Node* l{n->l_child};
+        Node* r{n->r_child};
+        delete n;
+        release(l);
+        n = r;
+    }
+}
+
+template< class K, class V, class cmp >
+typename PersistentBst<K,V,cmp>::Node* PersistentBst<K,V,cmp>::own(Node* n){
+    if(n->refs.load(std::memory_order_acquire)==1){
+        return n;
+    }
+    Node* cp{new Node(*n)};
+    release(n);
+    return cp;
+}
+
+template< class K, class V, class cmp >
+typename PersistentBst<K,V,cmp>::Node* PersistentBst<K,V,cmp>::rotate_left(Node* n){
+    Node* r{own(n->r_child)};
+    n->r_child = r->l_child;
+    r->l_child = n;
+    update_height(n);
+    update_height(r);
+    return r;
+}
+
+template< class K, class V, class cmp >
+typename PersistentBst<K,V,cmp>::Node* PersistentBst<K,V,cmp>::rotate_right(Node* n){
+    Node* l{own(n->l_child)};
+    n->l_child = l->r_child;
+    l->r_child = n;
+    update_height(n);
+    update_height(l);
+    return l;
+}
+
+template< class K, class V, class cmp >
+typename PersistentBst<K,V,cmp>::Node* PersistentBst<K,V,cmp>::rebalance(Node* n){
+    update_height(n);
+    int bf{node_height(n->l_child) - node_height(n->r_child)};
+
+    // left heavy
+    if(bf>1){
+        if(node_height(n->l_child->l_child) < node_height(n->l_child->r_child)){
+            n->l_child = own(n->l_child);
+            n->l_child = rotate_left(n->l_child);
+        }
+        return rotate_right(n);
+    }
+    // right heavy
+    if(bf<-1){
+        if(node_height(n->r_child->r_child) < node_height(n->r_child->l_child)){
+            n->r_child = own(n->r_child);
+            n->r_child = rotate_right(n->r_child);
+        }
+        return rotate_left(n);
+    }
+    return n;
+}
+
+template< class K, class V, class cmp >
+typename PersistentBst<K,V,cmp>::Node* PersistentBst<K,V,cmp>::owned_node(const K& key){
+    Node** link{&root};
+    while(*link){
+        *link = own(*link);
+        int c{compare_keys<cmp>(key,(*link)->kv.first)};
+        if(c==0){
+            return *link;
+        }
+        link = c<0? &(*link)->l_child : &(*link)->r_child;
+    }
+    return nullptr;
+}
+
+template< class K, class V, class cmp >
+const typename PersistentBst<K,V,cmp>::Node* PersistentBst<K,V,cmp>::find_node(const K& key) const noexcept{
+    const Node* n{root};
+    while(n){
+        int c{compare_keys<cmp>(key,n->kv.first)};
+        if(c==0){ break;}
+        n = c<0? n->l_child : n->r_child;
+    }
+    return n;
+}
+
+template< class K, class V, class cmp >
+template< class... vctorargtypes >
+bool PersistentBst<K,V,cmp>::emplace(const K& key, vctorargtypes&&... vctorargs){
+    // look first: no path copy for keys already there
+    if(find_node(key)){
+        return false;
+    }
+    Node* x{new Node(std::piecewise_construct,key,std::forward<vctorargtypes>(vctorargs)...)};
+
+    // make the path ours top-down: each copy is linked at once, so that a failure
+    // leaves the tree as it was (if partly made of copies)
+    Node** path[max_height];
+    int depth{0};
+    Node** link{&root};
+    try{
+        while(*link){
+            *link = own(*link);
+            path[depth++] = link;
+            link = cmp()(key,(*link)->kv.first)? &(*link)->l_child : &(*link)->r_child;
+        }
+    }
+    catch(...){
+        delete x;
+        throw;
+    }
+    *link = x;
+    ++size;
+
+    while(depth>0){
+        Node** l{path[--depth]};
+        *l = rebalance(*l);
+    }
+    return true;
+}
+
+template< class K, class V, class cmp >
+V& PersistentBst<K,V,cmp>::operator[](const K& key){
+    Node* n{owned_node(key)};
+    if(!n){
+        emplace(key);
+        n = owned_node(key);
+    }
+    return n->kv.second;
+}
+
+template< class K, class V, class cmp >
+bool PersistentBst<K,V,cmp>::erase(const K& key){
+    if(!find_node(key)){
+        return false;
+    }
+
+    // make the path ours top-down (see emplace())
+    Node** path[max_height];
+    int depth{0};
+    Node** link{&root};
+    while(true){
+        *link = own(*link);
+        int c{compare_keys<cmp>(key,(*link)->kv.first)};
+        if(c==0){ break;}
+        path[depth++] = link;
+        link = c<0? &(*link)->l_child : &(*link)->r_child;
+    }
+
+    Node* n{*link};
+    if(!n->l_child || !n->r_child){
+        *link = n->l_child? n->l_child : n->r_child;
+    }
+    else{
+        // the successor takes the place of n (the node itself: its pair is not copied)
+        int n_depth{depth};
+        path[depth++] = link;
+        Node** m_link{&n->r_child};
+        *m_link = own(*m_link);
+        while((*m_link)->l_child){
+            path[depth++] = m_link;
+            m_link = &(*m_link)->l_child;
+            *m_link = own(*m_link);
+        }
+
+        Node* m{*m_link};
+        *m_link = m->r_child;
+        m->l_child = n->l_child;
+        m->r_child = n->r_child;
+        *link = m;
+        if(depth>n_depth+1 && path[n_depth+1]==&n->r_child){
+            path[n_depth+1] = &m->r_child;
+        }
+    }
+    n->l_child = n->r_child = nullptr;
+    release(n);
+    --size;
+
+    while(depth>0){
+        Node** l{path[--depth]};
+        *l = rebalance(*l);
+    }
+    return true;
+}
+
+template< class K, class V, class cmp >
+typename PersistentBst<K,V,cmp>::const_iterator PersistentBst<K,V,cmp>::find(const K& key) const{
+    const_iterator it{lower_bound(key)};
+    if(it!=cend() && cmp()(key,(*it).first)){
+        return cend();
+    }
+    return it;
+}
+
+template< class K, class V, class cmp >
+typename PersistentBst<K,V,cmp>::const_iterator PersistentBst<K,V,cmp>::lower_bound(const K& key) const{
+    // keep the nodes where the walk turned left: they come next, in order
+    const_iterator it;
+    const Node* n{root};
+    while(n){
+        int c{compare_keys<cmp>(key,n->kv.first)};
+        if(c<=0){
+            it.stack.push_back(n);
+            if(c==0){ break;}
+            n = n->l_child;
+        }
+        else{
+            n = n->r_child;
+        }
+    }
+    return it;
+}
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>    // for std::upper_bound
+#include <iterator>     // for std::make_move_iterator
+#include <memory>       // for std::unique_ptr
+#include <mutex>        // for std::mutex, std::lock_guard, std::unique_lock
+#include <shared_mutex> // for std::shared_timed_mutex, std::shared_lock
+#include <utility>      // for std::forward, std::move
+#include <vector>
+#include <functional>   // for std::less
+
+#include "bst.hpp"
+
+
+/// @brief Ordered map split by key ranges into shards, each a Bst with its own lock,
+///        so that threads working on different ranges do not wait for each other.
+///
+/// Shard i holds the keys k with bounds[i-1] <= k < bounds[i]. Boundaries are
+/// recomputed by balance() from the quantiles of the keys present, so that shards
+/// end up (about) equally sized; until the first balance() every key goes to shard 0.
+/// Operations take the lock of the one shard they touch, plus a shared lock on the
+/// layout, which balance() takes exclusively while it moves elements around.
+///
+/// Lookups return copies: references into a shard would not survive the next writer.
+/// Iterators walk the shards one after the other, in key order; like Bst iterators,
+/// they must not be used while other threads change the map.
+///
+/// @tparam K       Type of the keys
+/// @tparam V       Type of the values
+/// @tparam cmp     Comparator class (default: std::less<K>)
+/// @tparam Alloc   Node allocation policy of the shards (default: heap_allocator)
+/// @tparam Balance Balancing policy of the shards (default: avl)
+template< class K, class V, class cmp = std::less<K>, template<class> class Alloc = heap_allocator, class Balance = avl >
+class ShardedBst{
+
+  public:
+    using kvpair = std::pair<const K,V>;
+    using tree_type = Bst<K,V,cmp,Alloc,Balance>;
+
+  private:
+
+    struct Shard{
+        std::mutex mtx;
+        tree_type tree;
+    };
+
+    unsigned int n_shards;
+    std::unique_ptr<Shard[]> shards;
+    std::vector<K> bounds;                  ///< first key of shards 1, 2... (at most n_shards-1 of them)
+    mutable std::shared_timed_mutex layout; ///< shared by operations, exclusive for balance()
+
+    /// @brief Index of the shard where key belongs.
+    unsigned int shard_of(const K& key) const{
+        return static_cast<unsigned int>(std::upper_bound(bounds.begin(),bounds.end(),key,cmp())-bounds.begin());
+    }
+
+    /// @brief Base template iterator class, stitching the shard iterators together.
+    ///
+    /// @tparam KV      Type returned by dereference op
+    /// @tparam Map     ShardedBst, possibly const
+    /// @tparam TreeIt  Iterator of the shards
+    template< class KV, class Map, class TreeIt >
+    class _iterator{
+
+        Map* map;
+        unsigned int shard;     ///< n_shards at end()
+        TreeIt current;
+
+        friend class ShardedBst;
+
+        /// @brief Moves on to the first element of the next non-empty shard, if current is at the end of its own.
+        void skip_empty(){
+            while(shard<map->n_shards && current==map->shards[shard].tree.end()){
+                if(++shard<map->n_shards){ current = map->shards[shard].tree.begin();}
+            }
+        }
+
+      public:
+        _iterator(Map* m, unsigned int s, TreeIt it): map(m), shard(s), current(it){ skip_empty();}
+
+        bool operator==(const _iterator& rhs) const{
+            return shard==rhs.shard && (shard==map->n_shards || current==rhs.current);
+        }
+        bool operator!=(const _iterator& rhs) const{return !(*this == rhs);}
+
+        /// @brief pre-increment.
+        _iterator& operator++(){
+            ++current;
+            skip_empty();
+            return *this;
+        }
+
+        /// @brief post-increment.
+        _iterator operator++(int){
+            _iterator cp{*this};
+            ++(*this);
+            return cp;
+        }
+
+        /// @brief de-reference op.
+        KV& operator*() const{ return *current;}
+    };
+
+  public:
+
+    typedef _iterator<kvpair,ShardedBst,typename tree_type::iterator> iterator;
+    typedef _iterator<const kvpair,const ShardedBst,typename tree_type::const_iterator> const_iterator;
+
+    /// @brief Builds an empty map with given number of shards
+    ///        (boundaries are set by the first balance()).
+    ///
+    /// @param n    number of shards (at least 1)
+    explicit ShardedBst(unsigned int n = 16): n_shards{n? n : 1}, shards{new Shard[n_shards]}{}
+
+    /// @brief Builds an empty map with given shard boundaries (one shard more than boundaries).
+    ///
+    /// @param boundaries   first key of the second, third... shard, in increasing order
+    explicit ShardedBst(std::vector<K> boundaries):
+        n_shards{static_cast<unsigned int>(boundaries.size())+1},
+        shards{new Shard[n_shards]},
+        bounds{std::move(boundaries)}{}
+
+    // the locks cannot be copied, nor moved
+    ShardedBst(const ShardedBst&) = delete;
+    ShardedBst& operator=(const ShardedBst&) = delete;
+
+    // Iterator interface (no concurrent writers!) ----------------------------
+
+    iterator begin(){ return iterator{this,0,shards[0].tree.begin()};}
+    const_iterator begin() const{ return const_iterator{this,0,shards[0].tree.cbegin()};}
+    const_iterator cbegin() const{ return begin();}
+
+    iterator end(){ return iterator{this,n_shards,shards[n_shards-1].tree.end()};}
+    const_iterator end() const{ return const_iterator{this,n_shards,shards[n_shards-1].tree.cend()};}
+    const_iterator cend() const{ return end();}
+
+    //--------
+    // Readers
+    //--------
+
+    /// @brief Looks for key and copies the value stored there.
+    ///
+    /// @param key      key to look for
+    /// @param value    (out) copy of the value at key, untouched if not found
+    /// @return bool    whether key was found
+    bool find(const K& key, V& value) const;
+
+    /// @brief Whether given key is present.
+    bool contains(const K& key) const;
+
+    /// @brief Getter for the number of elements (shards are counted one at a time).
+    unsigned int get_size() const;
+
+    /// @brief Number of shards.
+    unsigned int get_shard_count() const noexcept{ return n_shards;}
+
+    /// @brief Number of elements in a shard (for inspection).
+    unsigned int get_shard_size(unsigned int i) const;
+
+    //--------
+    // Writers
+    //--------
+
+    /// @brief Inserts a copy of given pair (nothing changes if key is present).
+    ///
+    /// @return bool whether the pair was inserted
+    bool insert(const kvpair& kv){ return emplace(kv.first,kv.second);}
+
+    /// @brief Inserts an element whose value is built from given args
+    ///        (nothing changes if key is present).
+    ///
+    /// @return bool whether the element was inserted
+    template< class... vctorargtypes >
+    bool emplace(const K& key, vctorargtypes&&... vctorargs);
+
+    /// @brief Stores value at key, replacing the previous one if key is present.
+    void insert_or_assign(const K& key, const V& value);
+
+    /// @brief Removes the element at given key (if present).
+    void erase(const K& key);
+
+    /// @brief Removes every element (boundaries are kept).
+    void clear();
+
+    /// @brief Moves the shard boundaries to the quantiles of the keys present, so that
+    ///        every shard gets the same number of elements (+-1), and rebuilds each shard
+    ///        as a balanced tree. Blocks every other operation meanwhile. O(N).
+    void balance();
+};
+
+
+//#############################################################################
+//DEFINITIONS
+//#############################################################################
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+bool ShardedBst<K,V,cmp,Alloc,Balance>::find(const K& key, V& value) const{
+    std::shared_lock<std::shared_timed_mutex> l{layout};
+    Shard& s{shards[shard_of(key)]};
+    std::lock_guard<std::mutex> lock{s.mtx};
+    auto it{s.tree.find(key)};
+    if(it==s.tree.end()){
+        return false;
+    }
+    value = (*it).second;
+    return true;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+bool ShardedBst<K,V,cmp,Alloc,Balance>::contains(const K& key) const{
+    std::shared_lock<std::shared_timed_mutex> l{layout};
+    Shard& s{shards[shard_of(key)]};
+    std::lock_guard<std::mutex> lock{s.mtx};
+    return s.tree.contains(key);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+unsigned int ShardedBst<K,V,cmp,Alloc,Balance>::get_size() const{
+    std::shared_lock<std::shared_timed_mutex> l{layout};
+    unsigned int n{0};
+    for(unsigned int iii{0};iii<n_shards;++iii){
+        std::lock_guard<std::mutex> lock{shards[iii].mtx};
+        n += shards[iii].tree.get_size();
+    }
+    return n;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+unsigned int ShardedBst<K,V,cmp,Alloc,Balance>::get_shard_size(unsigned int i) const{
+    std::shared_lock<std::shared_timed_mutex> l{layout};
+    std::lock_guard<std::mutex> lock{shards[i].mtx};
+    return shards[i].tree.get_size();
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+template< class... vctorargtypes >
+bool ShardedBst<K,V,cmp,Alloc,Balance>::emplace(const K& key, vctorargtypes&&... vctorargs){
+    std::shared_lock<std::shared_timed_mutex> l{layout};
+    Shard& s{shards[shard_of(key)]};
+    std::lock_guard<std::mutex> lock{s.mtx};
+    return s.tree.emplace(key,std::forward<vctorargtypes>(vctorargs)...).second;
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+void ShardedBst<K,V,cmp,Alloc,Balance>::insert_or_assign(const K& key, const V& value){
+    std::shared_lock<std::shared_timed_mutex> l{layout};
+    Shard& s{shards[shard_of(key)]};
+    std::lock_guard<std::mutex> lock{s.mtx};
+    s.tree.insert_or_assign(key,value);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+void ShardedBst<K,V,cmp,Alloc,Balance>::erase(const K& key){
+    std::shared_lock<std::shared_timed_mutex> l{layout};
+    Shard& s{shards[shard_of(key)]};
+    std::lock_guard<std::mutex> lock{s.mtx};
+    s.tree.erase(key);
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+void ShardedBst<K,V,cmp,Alloc,Balance>::clear(){
+    std::unique_lock<std::shared_timed_mutex> l{layout};
+    for(unsigned int iii{0};iii<n_shards;++iii){
+        shards[iii].tree.clear();
+    }
+}
+
+template< class K, class V, class cmp, template<class> class Alloc, class Balance >
+void ShardedBst<K,V,cmp,Alloc,Balance>::balance(){
+    std::unique_lock<std::shared_timed_mutex> l{layout};
+
+    // every element, in key order (shards are already sorted among themselves)
+    std::vector<std::pair<K,V>> all;
+    for(unsigned int iii{0};iii<n_shards;++iii){
+        for(auto& kv: shards[iii].tree){
+            all.emplace_back(kv.first,std::move(kv.second));
+        }
+        shards[iii].tree.clear();
+    }
+    if(all.empty()){
+        return;
+    }
+
+    // shard i gets the elements i*N/n_shards ... (i+1)*N/n_shards-1
+    std::size_t N{all.size()};
+    std::vector<K> new_bounds;
+    for(unsigned int iii{1};iii<n_shards;++iii){
+        new_bounds.push_back(all[iii*N/n_shards].first);
+    }
+    bounds = std::move(new_bounds);
+
+    std::size_t first{0};
+    for(unsigned int iii{0};iii<n_shards;++iii){
+        std::size_t last{(iii+1)*N/n_shards};
+        shards[iii].tree.assign(std::make_move_iterator(all.begin()+first),
+                                std::make_move_iterator(all.begin()+last),
+                                range_order::sorted_unique);
+        first = last;
+    }
+}
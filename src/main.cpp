@@ -8,6 +8,8 @@ int main(){
 
     std::cout<<"\nNOTE:Exit the interactive demo to start performance test!\n"<<std::endl;
     test_interactive();
+    test_lockfree_stress();
+    test_cow_handles();
     test_performance();
 
     return 0;